@@ -22,7 +22,8 @@
 
 #include "ATReplies.h"
 #include "Logger.h"
-#include "divideandconquer_01.h"
+#include "SerialTx.h"
+#include "PerfectHash.h"
 
 #include "syntacticsugar.h"
 
@@ -77,45 +78,48 @@
 
 namespace at_replies {
 
+#define GENERATE_STRING(STRING) #STRING,
+static constexpr const char *COMMAND_STRINGS[] = {
+  MyATCommand_gen(GENERATE_STRING)
+};
+#undef GENERATE_STRING
+static constexpr PerfectHash<INVALID_EXPECTED_AT, 5> COMMAND_HASH(COMMAND_STRINGS);
+
 MyATCommand ATReplies::handle_nuvoTon_comms(Logger &logger) {
   // Let's hope that communication doesn't get interrupted and that it doesn't take too long.
   // TODO: Use SafeString library / asynchronous Serial reading?
-  const String stringIn = Serial.readStringUntil('\n');
-  const size_t strInLen = stringIn.length();
-  if (strInLen == 0) {
+  char line[64];
+  size_t len = Serial.readBytesUntil('\n', line, sizeof(line) - 1);
+  if (len > 0 && line[len - 1] == '\r') {
+    --len;
+  }
+  line[len] = '\0';
+  if (len == 0) {
     logger.logNow("{'error': 'empty line on serial encountered'}");
 return INVALID_EXPECTED_AT;
   }
-//  {
-//    char tmpStr[strInLen + 1];
-//    stringIn.toCharArray(tmpStr, strInLen);
-//    tmpStr[strInLen] = '\0';
-//    logger.debug(F("{'Serial_received': '%s'}"), tmpStr);
-//  }
-  if (!stringIn.startsWith("AT+")) {
-    logger.debug(F("{'error': 'unexpected input', 'rawdata': '%s'}"), stringIn);
+  if (len < 3 || memcmp(line, "AT+", 3) != 0) {
+    LOG_DEBUG("{'error': 'unexpected input', 'rawdata': '%s'}", line);
 return INVALID_EXPECTED_AT;
   }
 
-  #define GENERATE_STRING(STRING) #STRING,
-  const String COMMAND_STRINGS[] = {
-    MyATCommand_gen(GENERATE_STRING)
-  };
-  #undef GENERATE_STRING
-  
-  size_t ret = INVALID_EXPECTED_AT;
-  const String partToSearch = stringIn.substring(3);
-  // FIXME: split at next plus-sign
-  if (DivideAndConquer01::binarysearchString(ret, COMMAND_STRINGS, partToSearch, sizeof COMMAND_STRINGS)) {
-    // no need to bounds-check (provided that the string table for this enum is correct)
-return (MyATCommand) ret;
-  } else {
-return INVALID_EXPECTED_AT;
+  char * const command = line + 3;
+  const size_t commandLen = len - 3;
+  char * const equals = (char *) memchr(command, '=', commandLen);
+  if (equals != nullptr) {
+    *equals = '_';
+  }
+  // "CWMODE_1" as a whole, else just "CIPSERVER" of "CIPSERVER_1,8080"
+  size_t ret = COMMAND_HASH.find(command, commandLen);
+  if (ret == INVALID_EXPECTED_AT && equals != nullptr) {
+    ret = COMMAND_HASH.find(command, equals - command);
   }
+  // no need to bounds-check (provided that the string table for this enum is correct)
+return (MyATCommand) ret;
 }
 
 inline void ATReplies::answer_ok(Logger &logger) {
-  Serial.println("OK");
+  serialTx.println(TX_REPLY, "OK");
 }
 
 }
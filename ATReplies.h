@@ -28,7 +28,7 @@
 namespace at_replies {
 
 // define enum stringlist https://stackoverflow.com/a/10966395
-// needs to be sorted
+// '_' stands for '='; names without it match regardless of the arguments
 #define MyATCommand_gen(FRUIT)      \
         FRUIT(CIPMUX_1) \
         FRUIT(CIPSERVER)            \
@@ -0,0 +1,141 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "BinaryControl.h"
+#include "RemoteRelay.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+
+BinaryControl::BinaryControl(const uint16_t port) : server(port) {
+  for (uint8_t i = BINARYCONTROL_CLIENTS; i --> 0; ) {
+    clients[i].used = 0;
+  }
+  channelCount = 0;
+  started = false;
+}
+
+void BinaryControl::begin(const uint8_t count) {
+  if (started) {
+    // AT+CIPSERVER may be repeated
+return;
+  }
+  channelCount = min(count, (uint8_t) RELAY_NUMBER_OF_CHANNELS);
+  server.begin();
+  server.setNoDelay(true);
+  started = true;
+}
+
+/**
+ * @returns true if ip is in the subnet of the station or of the soft AP. The port has no
+ * authentication, it must not be reachable through a router's port forwarding.
+ */
+static bool isLocal(const IPAddress &ip) {
+  const uint32_t station = WiFi.localIP();
+  if (station != 0 && ((ip ^ station) & WiFi.subnetMask()) == 0) {
+return true;
+  }
+  // the soft AP is always a /24
+  const uint32_t ap = WiFi.softAPIP();
+  return ap != 0 && ((ip ^ ap) & (uint32_t) IPAddress(255, 255, 255, 0)) == 0;
+}
+
+void BinaryControl::handleFrame(Client &c) {
+  const uint8_t channel = c.frame[1];
+  const uint8_t opcode = c.frame[2];
+  if (channel < 1 || channel > channelCount) {
+    LOG_DEBUG("{'binaryControl': 'invalid channel', 'channel': %u}", (unsigned int) channel);
+return;
+  }
+  switch (opcode) {
+    case R_OPEN:
+    case R_CLOSE: {
+      timerWheel.cancel(channel);
+      relayQueue.request(channel, (RSTM32Mode) opcode);
+    }
+    break;
+    case BINARYCONTROL_QUERY: {
+      const uint8_t reply[4] = {
+        BINARYCONTROL_HEADER,
+        channel,
+        (uint8_t) getChannel(channel),
+        (uint8_t) (BINARYCONTROL_HEADER + channel + getChannel(channel)),
+      };
+      c.client.write(reply, sizeof(reply));
+    }
+    break;
+    default: {
+      LOG_DEBUG("{'binaryControl': 'invalid opcode', 'opcode': %u}", (unsigned int) opcode);
+    }
+    break;
+  }
+}
+
+void BinaryControl::service() {
+  if (!started) {
+return;
+  }
+  if (server.hasClient()) {
+    WiFiClient incoming = server.accept();
+    if (!isLocal(incoming.remoteIP())) {
+      LOG_DEBUG("{'binaryControl': 'not local', 'IPAddress': '%s'}", incoming.remoteIP().toString().c_str());
+      incoming.stop();
+return;
+    }
+    uint8_t i = BINARYCONTROL_CLIENTS;
+    while (i --> 0 && clients[i].client.connected()) {
+    }
+    if (i < BINARYCONTROL_CLIENTS) {
+      clients[i].client = incoming;
+      clients[i].client.setNoDelay(true);
+      clients[i].used = 0;
+    } else {
+      // all slots taken
+      incoming.stop();
+    }
+  }
+
+  for (uint8_t i = BINARYCONTROL_CLIENTS; i --> 0; ) {
+    Client &c = clients[i];
+    while (c.client.available() > 0) {
+      const int b = c.client.read();
+      if (c.used == 0 && b != BINARYCONTROL_HEADER) {
+        // resynchronize
+    continue;
+      }
+      c.frame[c.used++] = b;
+      if (c.used < sizeof(c.frame)) {
+    continue;
+      }
+      if ((uint8_t) (c.frame[0] + c.frame[1] + c.frame[2]) != c.frame[3]) {
+        LOG_DEBUG("{'binaryControl': 'checksum mismatch'}");
+        // the header may have been a stray byte, a frame can start within the others
+        uint8_t from = 1;
+        while (from < sizeof(c.frame) && c.frame[from] != BINARYCONTROL_HEADER) {
+          ++from;
+        }
+        c.used = sizeof(c.frame) - from;
+        memmove(c.frame, c.frame + from, c.used);
+    continue;
+      }
+      c.used = 0;
+      handleFrame(c);
+    }
+  }
+}
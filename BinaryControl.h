@@ -0,0 +1,68 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef BINARYCONTROL_H
+#define BINARYCONTROL_H
+
+#include <ESP8266WiFi.h>
+
+#define BINARYCONTROL_CLIENTS 2
+#define BINARYCONTROL_HEADER 0xA0
+#define BINARYCONTROL_QUERY 0x02      // Opcode in place of the mode, answered with the channel's state frame
+
+/**
+ * Raw TCP port speaking the stock LCTech frames A0 <channel> <mode> <checksum>,
+ * the same as RSTM32Payload. No authentication, like the stock firmware, so only clients
+ * from the local subnet (of the station or the soft AP) are accepted.
+ *
+ * Everything happens in service() with fixed per-client frame buffers, no HTTP parsing
+ * and no String. Bytes that don't form a valid frame are skipped until the next header,
+ * after a checksum mismatch the search starts at the frame's second byte.
+ *
+ * Switching goes through relayQueue like the other front ends, so it reaches the relay board
+ * within the same service() call only if the channel didn't switch within the last
+ * RELAY_MIN_INTERVAL_MS. Faster toggles are deferred until then, the interval protects the
+ * relays and holds for this port as well.
+ */
+class BinaryControl {
+  private:
+    struct Client {
+      WiFiClient client;
+      uint8_t frame[4];
+      uint8_t used;
+    };
+
+    WiFiServer server;
+    Client clients[BINARYCONTROL_CLIENTS];
+    uint8_t channelCount;
+    bool started;
+
+  public:
+    BinaryControl(uint16_t port);
+    void begin(uint8_t channelCount);
+    void service();                       // Accept and handle frames, call from loop()
+
+  private:
+    void handleFrame(Client &);
+};
+
+extern BinaryControl binaryControl;
+
+#endif  // BINARYCONTROL_H
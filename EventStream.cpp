@@ -0,0 +1,86 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "EventStream.h"
+
+EventStream::EventStream() {
+  lastSent = 0;
+  dropped = 0;
+}
+
+bool EventStream::subscribe(WiFiClient &client) {
+  for (uint8_t i = EVENTSTREAM_SUBSCRIBERS; i --> 0; ) {
+    if (subscribers[i].connected()) {
+  continue;
+    }
+    // pucgenie: written by hand, the web server would add its own headers and end the response.
+    const char HEADER[] = "HTTP/1.1 200 OK\r\n\
+Content-Type: text/event-stream\r\n\
+Cache-Control: no-cache\r\n\
+Connection: keep-alive\r\n\
+\r\n\
+retry: 3000\n\n";
+    // all or nothing, the caller answers 503 if nothing was written
+    if ((size_t) client.availableForWrite() < sizeof(HEADER) - 1) {
+return false;
+    }
+    client.setNoDelay(true);
+    if (client.write((const uint8_t *) HEADER, sizeof(HEADER) - 1) != sizeof(HEADER) - 1) {
+      // too late for another response
+      client.stop();
+      ++dropped;
+return false;
+    }
+    subscribers[i] = client;
+return true;
+  }
+  return false;
+}
+
+bool EventStream::send(WiFiClient &client, const char * const event, const size_t len) {
+  if ((size_t) client.availableForWrite() < len) {
+    // don't let a slow reader stall the loop
+    client.stop();
+    ++dropped;
+return false;
+  }
+  client.write((const uint8_t *) event, len);
+  return true;
+}
+
+void EventStream::publish(const char * const event, const size_t len) {
+  for (uint8_t i = EVENTSTREAM_SUBSCRIBERS; i --> 0; ) {
+    WiFiClient &client = subscribers[i];
+    if (!client.connected()) {
+  continue;
+    }
+    send(client, event, len);
+  }
+  lastSent = millis();
+}
+
+void EventStream::service() {
+  if (millis() - lastSent < EVENTSTREAM_KEEPALIVE_MS) {
+return;
+  }
+  // comment line, keeps proxies and the client's timeout happy
+  const char KEEPALIVE[] = ":\n\n";
+  publish(KEEPALIVE, sizeof(KEEPALIVE) - 1);
+}
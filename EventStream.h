@@ -0,0 +1,54 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef EVENTSTREAM_H
+#define EVENTSTREAM_H
+
+#include <ESP8266WiFi.h>
+
+#define EVENTSTREAM_SUBSCRIBERS 4
+#define EVENTSTREAM_KEEPALIVE_MS 15000
+
+/**
+ * Server-Sent Events to a fixed number of subscribers.
+ *
+ * Subscribers keep the connection of their GET /events request, the web server has
+ * forgotten about it after the handler returned. Events are written to the TCP send
+ * buffers directly; a subscriber that has no room for an event (slow or gone) is
+ * dropped instead of waiting for it.
+ */
+class EventStream {
+  private:
+    WiFiClient subscribers[EVENTSTREAM_SUBSCRIBERS];
+    uint32_t lastSent;
+    uint16_t dropped;
+
+  public:
+    EventStream();
+    bool subscribe(WiFiClient &);                 // Send the response header, false if it can't (the client is stopped if it was cut short)
+    bool send(WiFiClient &, const char *event, size_t len);  // Send a complete event to one subscriber, false if it was dropped
+    void publish(const char *event, size_t len);  // Send a complete event ("data: ...\n\n") to all subscribers
+    void service();                               // Keep-alives, call from loop()
+    uint16_t getDropped() const { return dropped; }
+};
+
+extern EventStream eventStream;
+
+#endif  // EVENTSTREAM_H
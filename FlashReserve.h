@@ -0,0 +1,61 @@
+/*************************************************************************
+ *
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef FLASHRESERVE_H
+#define FLASHRESERVE_H
+
+#include <Arduino.h>
+
+/**
+ * Flash sectors used outside of EEPROM emulation.
+ * They are taken from the filesystem area of the flash layout ("1M (64K SPIFFS)" gives 16 sectors),
+ * so don't mount SPIFFS/LittleFS in this sketch.
+ */
+extern "C" uint32_t _FS_start;
+extern "C" uint32_t _FS_end;
+
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE 0x100
+#endif
+#define FLASH_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+// offsets in sectors from the start of the filesystem area
+#define FLASH_RESERVE_PERSISTENT_LOG 0
+#define FLASH_RESERVE_PERSISTENT_LOG_SECTORS 2
+#define FLASH_RESERVE_SCHEDULES 2
+#define FLASH_RESERVE_STATE_JOURNAL 3
+#define FLASH_RESERVE_STATE_JOURNAL_SECTORS 2
+#define FLASH_RESERVE_GROUPS 5
+#define FLASH_RESERVE_UDP_SEQ 6
+#define FLASH_RESERVE_UDP_SEQ_SECTORS 2
+#define FLASH_RESERVE_SECTORS 8
+
+/**
+ * @returns absolute sector number or 0 if the flash layout has no room for it
+ */
+inline uint32_t flash_reserve_sector(const uint32_t offset) {
+  const uint32_t first = ((uintptr_t) &_FS_start - 0x40200000) / FLASH_SECTOR_SIZE;
+  const uint32_t last = ((uintptr_t) &_FS_end - 0x40200000) / FLASH_SECTOR_SIZE;
+  if (first + FLASH_RESERVE_SECTORS > last) {
+return 0;
+  }
+  return first + offset;
+}
+
+#endif  // FLASHRESERVE_H
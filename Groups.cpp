@@ -0,0 +1,127 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "Groups.h"
+#include <lwip/igmp.h>
+
+Groups::Groups() {
+  memset(&table, 0, sizeof(table));
+  sector = 0;
+  joined = false;
+}
+
+void Groups::begin() {
+  sector = flash_reserve_sector(FLASH_RESERVE_GROUPS);
+  if (sector == 0) {
+    LOG_INFO("{'groups': 'no flash reserved'}");
+return;
+  }
+  ESP.flashRead(sector * FLASH_SECTOR_SIZE, (uint32_t *) &table, sizeof(table));
+  if (table.magic != GROUPS_MAGIC || table.count > GROUPS_MAX
+      || table.crc != RemoteRelaySettings::crc8((const uint8_t *) table.entries, table.count * sizeof(GroupEntry))) {
+    // erased or damaged, start empty
+    memset(&table, 0, sizeof(table));
+  }
+  LOG_INFO("{'groups': %u}", (unsigned int) table.count);
+}
+
+bool Groups::isFirstUse(const uint8_t i) const {
+  for (uint8_t j = i; j --> 0; ) {
+    if (table.entries[j].address == table.entries[i].address) {
+return false;
+    }
+  }
+  return true;
+}
+
+void Groups::joinAll() {
+  for (uint8_t i = 0; i < table.count; ++i) {
+    if (!isFirstUse(i)) {
+  continue;
+    }
+    ip4_addr_t address;
+    address.addr = table.entries[i].address;
+    if (igmp_joingroup(IP4_ADDR_ANY4, &address) != ERR_OK) {
+      LOG_INFO("{'groups': 'join failed', 'address': '%s'}", IPAddress(address.addr).toString().c_str());
+    }
+  }
+  joined = true;
+}
+
+void Groups::leaveAll() {
+  for (uint8_t i = 0; i < table.count; ++i) {
+    if (!isFirstUse(i)) {
+  continue;
+    }
+    ip4_addr_t address;
+    address.addr = table.entries[i].address;
+    igmp_leavegroup(IP4_ADDR_ANY4, &address);
+  }
+}
+
+void Groups::save() {
+  table.magic = GROUPS_MAGIC;
+  table.crc = RemoteRelaySettings::crc8((const uint8_t *) table.entries, table.count * sizeof(GroupEntry));
+  // rarely changed, rewriting the whole sector is fine
+  ESP.flashEraseSector(sector);
+  ESP.flashWrite(sector * FLASH_SECTOR_SIZE, (const uint32_t *) &table, sizeof(table));
+}
+
+bool Groups::add(const GroupEntry &entry) {
+  if (sector == 0 || table.count >= GROUPS_MAX) {
+return false;
+  }
+  if (joined) {
+    leaveAll();
+  }
+  table.entries[table.count++] = entry;
+  save();
+  if (joined) {
+    joinAll();
+  }
+  return true;
+}
+
+bool Groups::remove(const uint8_t i) {
+  if (i >= table.count) {
+return false;
+  }
+  if (joined) {
+    leaveAll();
+  }
+  memmove(table.entries + i, table.entries + i + 1, (table.count - i - 1) * sizeof(GroupEntry));
+  --table.count;
+  save();
+  if (joined) {
+    joinAll();
+  }
+  return true;
+}
+
+uint8_t Groups::channels(const uint32_t address, const uint8_t group) const {
+  uint8_t mask = 0;
+  for (uint8_t i = table.count; i --> 0; ) {
+    const GroupEntry &entry = table.entries[i];
+    if (entry.address == address && entry.group == group) {
+      mask |= entry.channels;
+    }
+  }
+  return mask;
+}
@@ -0,0 +1,82 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef GROUPS_H
+#define GROUPS_H
+
+#include "RemoteRelay.h"
+#include "FlashReserve.h"
+
+#define GROUPS_MAX 16
+#define GROUPS_MAGIC 0x52475252           // "RRGR"
+
+/**
+ * Membership in a group of boards: group commands to this multicast address
+ * and group number switch the channels in the mask.
+ */
+struct GroupEntry {
+  uint32_t address;         // IPv4 multicast address, as IPAddress converts it
+  uint8_t group;
+  uint8_t channels;         // channel 1 is bit 0
+  uint16_t reserved;
+};
+
+/**
+ * Multicast group memberships, kept in a reserved flash sector.
+ *
+ * The IGMP memberships follow the table once joinAll() was called; a board joins
+ * each distinct address once, however many entries use it.
+ */
+class Groups {
+  private:
+    /**
+     * Flash image of the table.
+     */
+    struct Storage {
+      uint32_t magic;
+      uint8_t count;
+      uint8_t crc;          // crc8 of the used entries
+      uint16_t reserved;
+      GroupEntry entries[GROUPS_MAX];
+    };
+
+    Storage table;
+    uint32_t sector;
+    bool joined;
+
+  public:
+    Groups();
+    void begin();                                       // Load table, call once in setup()
+    void joinAll();                                     // Join the multicast addresses, once the station is up
+    uint8_t getCount() const { return table.count; }
+    const GroupEntry &get(uint8_t i) const { return table.entries[i]; }
+    bool add(const GroupEntry &);                       // false if the table is full
+    bool remove(uint8_t i);                             // false if there's no such entry
+    uint8_t channels(uint32_t address, uint8_t group) const;  // Mask of the channels that group switches
+
+  private:
+    void save();
+    bool isFirstUse(uint8_t i) const;                   // No earlier entry has the same address
+    void leaveAll();
+};
+
+extern Groups groups;
+
+#endif  // GROUPS_H
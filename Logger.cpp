@@ -20,23 +20,44 @@
  * ***********************************************************************/
 
 #include "Logger.h"
+#include "SerialTx.h"
 
 Logger::Logger() {
   // Init ring log
-  for (int i = RINGLOG_SIZE; i --> 0; ) {
-    ringlog[i][0]='\0';
-  }
+  ringHead = 0;
+  ringUsed = 0;
+  ringLines = 0;
+  ringFirstSeq = 0;
 
   enableDebug = false;
   enableSerial = false;
 }
 
+void Logger::begin() {
+#ifdef LOGGER_PERSISTENT
+  persistent.begin();
+#endif
+}
+
+void Logger::service() {
+#ifdef LOGGER_PERSISTENT
+  persistent.service();
+#endif
+}
+
+void Logger::flush() {
+#ifdef LOGGER_PERSISTENT
+  persistent.flush();
+#endif
+}
+
 void Logger::setDebug(bool d) {
   enableDebug = d;
 }
 
 void Logger::setSerial(bool d) {
   enableSerial = d;
+  serialTx.setLineBreaks(d);
 }
 
 void Logger::debug(const __FlashStringHelper *fmt, ...) {
@@ -58,28 +79,121 @@ void Logger::info(const __FlashStringHelper *fmt, ...) {
 
 
 void Logger::logNow(const char* const p_buffer) {
+  uint8_t record[LOG_RECORD_MAX];
+  record[0] = RECORD_TEXT;
   // Add timestamp header
-  uint32_t uptime = millis();
-  // pucgenie: don't use F() here.
-  const char LOG_MILLIS_FORMAT[] = "[%07d] ";
-  #define len_LOG_MILLIS_FORMAT sizeof(LOG_MILLIS_FORMAT)-1
-  char * const ringlogline = ringlog[index];
-  // pucgenie: I don't like \0
-  snprintf(ringlogline, len_LOG_MILLIS_FORMAT + 1, LOG_MILLIS_FORMAT, uptime);
-  strncpy(ringlogline + len_LOG_MILLIS_FORMAT, p_buffer, BUF_LEN - len_LOG_MILLIS_FORMAT);
-  #undef  len_LOG_MILLIS_FORMAT
+  const uint32_t uptime = millis();
+  memcpy(record + 1, &uptime, sizeof(uptime));
+  const size_t len = strnlen(p_buffer, LOG_RECORD_MAX - LOG_RECORD_HEADER);
+  memcpy(record + LOG_RECORD_HEADER, p_buffer, len);
   
   if (enableSerial) {
-    Serial.println(ringlogline);
+    printRecord(record, LOG_RECORD_HEADER + len);
   }
   
-  // Loop over at the begining of the ring
-  if (++index >= RINGLOG_SIZE) {
-    index = 0;
+  ringPush(record, LOG_RECORD_HEADER + len);
+}
+
+void Logger::ringPush(const uint8_t * const record, const uint8_t len) {
+  const uint16_t needed = len + 1;
+  // Evict the oldest records whole until the new one fits
+  while (RINGLOG_BYTES - ringUsed < needed) {
+    const uint16_t evicted = ringlog[ringHead] + 1;
+    ringHead = (ringHead + evicted) % RINGLOG_BYTES;
+    ringUsed -= evicted;
+    --ringLines;
+    ++ringFirstSeq;
+  }
+
+  uint16_t tail = (ringHead + ringUsed) % RINGLOG_BYTES;
+  ringlog[tail] = len;
+  tail = (tail + 1) % RINGLOG_BYTES;
+  // Second part is only non-empty if the record wraps around the end
+  const uint16_t firstPart = min((uint16_t) len, (uint16_t) (RINGLOG_BYTES - tail));
+  memcpy(ringlog + tail, record, firstPart);
+  memcpy(ringlog, record + firstPart, len - firstPart);
+
+  ringUsed += needed;
+  ++ringLines;
+
+#ifdef LOGGER_PERSISTENT
+  persistent.append(record, len);
+#endif
+}
+
+uint8_t Logger::ringRead(uint16_t &offset, uint8_t * const record) const {
+  const uint8_t len = ringlog[offset];
+  const uint16_t start = (offset + 1) % RINGLOG_BYTES;
+  const uint16_t firstPart = min((uint16_t) len, (uint16_t) (RINGLOG_BYTES - start));
+  memcpy(record, ringlog + start, firstPart);
+  memcpy(record + firstPart, ringlog, len - firstPart);
+  offset = (start + len) % RINGLOG_BYTES;
+  return len;
+}
+
+void Logger::printRecord(const uint8_t * const record, const uint8_t len) {
+  char line[BUF_LEN + 2];
+  size_t lineLen = render(record, len, line, BUF_LEN);
+  line[lineLen++] = '\r';
+  line[lineLen++] = '\n';
+  // dropped if the UART can't keep up
+  serialTx.write(TX_LOG, (const uint8_t *) line, lineLen);
+}
+
+size_t Logger::render(const uint8_t * const record, const uint8_t len, char * const line, const size_t lineSize) {
+  uint32_t uptime;
+  memcpy(&uptime, record + 1, sizeof(uptime));
+  // pucgenie: don't use F() here.
+  const char LOG_MILLIS_FORMAT[] = "[%07d] ";
+  size_t pos = snprintf(line, lineSize, LOG_MILLIS_FORMAT, uptime);
+  switch ((RecordKind) record[0]) {
+    case RECORD_TEXT: {
+      const size_t textLen = min((size_t) (len - LOG_RECORD_HEADER), lineSize - pos - 1);
+      memcpy(line + pos, record + LOG_RECORD_HEADER, textLen);
+      pos += textLen;
+      line[pos] = '\0';
+    }
+    break;
+#ifdef LOGGER_DEFERRED_FORMAT
+    case RECORD_DEFERRED: {
+      PGM_P fmt;
+      memcpy(&fmt, record + LOG_RECORD_HEADER, sizeof(fmt));
+      pos += renderDeferred(fmt, record + LOG_RECORD_HEADER + sizeof(fmt), len - LOG_RECORD_HEADER - sizeof(fmt), line + pos, lineSize - pos);
+    }
+    break;
+#endif
+    default: {
+      line[pos] = '\0';
+    }
+    break;
   }
+  return pos;
 }
 
 void Logger::log(const __FlashStringHelper *fmt, va_list ap) {
+#ifdef LOGGER_DEFERRED_FORMAT
+  {
+    uint8_t record[LOG_RECORD_MAX];
+    record[0] = RECORD_DEFERRED;
+    const uint32_t uptime = millis();
+    memcpy(record + 1, &uptime, sizeof(uptime));
+    PGM_P const format = reinterpret_cast<PGM_P>(fmt);
+    memcpy(record + LOG_RECORD_HEADER, &format, sizeof(format));
+    va_list args;
+    va_copy(args, ap);
+    const size_t packed = packArgs(format, args, record + LOG_RECORD_HEADER + sizeof(format), LOG_RECORD_MAX - LOG_RECORD_HEADER - sizeof(format));
+    va_end(args);
+    if (packed != SIZE_MAX) {
+      const uint8_t len = LOG_RECORD_HEADER + sizeof(format) + packed;
+      if (enableSerial) {
+        printRecord(record, len);
+      }
+      ringPush(record, len);
+return;
+    }
+  }
+  // Arguments don't fit into a record or can't be packed, format them right away.
+#endif
   // just keep it allocated
   static char buffer[BUF_LEN];
   // Generate log message (does not support float)
@@ -88,52 +202,342 @@ void Logger::log(const __FlashStringHelper *fmt, va_list ap) {
   logNow(buffer);
 }
 
-void Logger::getLog(String &msg) {
-  // Get uptime
-  char uptime[9];
-  // pucgenie: microoptimization: Don't use F() here.
-  {
-    int _printerror = snprintf(uptime, sizeof(uptime), "%08lu", millis() / 1000);
-    if (_printerror < 0 || ((unsigned int) _printerror >= sizeof(uptime))) {
-      // can't use logger...
-      Serial.println(F("Time formatting broken. Continuing anyway..."));
+#ifdef LOGGER_DEFERRED_FORMAT
+/**
+ * Integer length modifiers understood by packArgs() and renderDeferred().
+ */
+enum LogArgSize : uint8_t {
+  ARG_INT,
+  ARG_LONG,
+  ARG_LONGLONG,
+  ARG_SIZE_T,
+  ARG_UNSUPPORTED,
+};
+
+/**
+ * Skips flags, width, precision and length modifier of a conversion specification.
+ * Star values are fetched through onStar, which returns false to abort.
+ * @returns the conversion character (fmt points behind it) or '\0' if aborted
+ */
+template<typename StarHandler> static char parseSpec(PGM_P &fmt, char c, int &precision, LogArgSize &argSize, StarHandler onStar) {
+  // assigned on every path, also when aborted
+  precision = -1;
+  argSize = ARG_INT;
+  while (c == '-' || c == '+' || c == ' ' || c == '#' || c == '0') {
+    c = pgm_read_byte(fmt++);
+  }
+  if (c == '*') {
+    int width;
+    if (!onStar(width)) {
+return '\0';
     }
+    c = pgm_read_byte(fmt++);
+  } else while (c >= '0' && c <= '9') {
+    c = pgm_read_byte(fmt++);
   }
+  if (c == '.') {
+    precision = 0;
+    c = pgm_read_byte(fmt++);
+    if (c == '*') {
+      if (!onStar(precision)) {
+return '\0';
+      }
+      c = pgm_read_byte(fmt++);
+    } else while (c >= '0' && c <= '9') {
+      precision = precision * 10 + (c - '0');
+      c = pgm_read_byte(fmt++);
+    }
+  }
+  while (c == 'h' || c == 'l' || c == 'z' || c == 'j' || c == 't' || c == 'L' || c == 'q') {
+    switch (c) {
+      case 'h': break;
+      case 'l': argSize = (argSize == ARG_LONG) ? ARG_LONGLONG : ARG_LONG; break;
+      case 'z': argSize = ARG_SIZE_T; break;
+      default: argSize = ARG_UNSUPPORTED; break;
+    }
+    c = pgm_read_byte(fmt++);
+  }
+  return c;
+}
 
-  // pucgenie: Don't worry about a few wasted CPU cycles to do that everytime.
-  if (!msg.reserve(255)) {
-    // can't use logger...
-    Serial.println(F("Couldn't reserve String buffer. Continuing anyway..."));
+/**
+ * Copies the arguments referenced by fmt into out: numbers and pointers as raw words,
+ * strings inline including their terminator (cut to the precision if one is given).
+ * @returns count of bytes packed or SIZE_MAX if they don't fit or can't be packed
+ */
+size_t Logger::packArgs(PGM_P fmt, va_list ap, uint8_t * const out, const size_t outSize) {
+  size_t used = 0;
+  #define PACK_ARG(T, VALUE) { \
+    const T _value = (VALUE); \
+    if (used + sizeof(T) > outSize) { \
+return SIZE_MAX; \
+    } \
+    memcpy(out + used, &_value, sizeof(T)); \
+    used += sizeof(T); \
   }
-  // Generate header
-  msg += " ==== DEBUG LOG ====\r\n\
-Chip ID: ";
-  msg += ESP.getChipId();
-  msg += "\r\nFree Heap: ";
-  msg += ESP.getFreeHeap();
-  msg += "\r\nFlash Size: ";
-  msg += ESP.getFlashChipSize();
-  msg += "\r\nUptime: ";
-  msg += uptime;
-  msg += "\r\nPrinting last ";
-  msg += RINGLOG_SIZE;
-  msg += " lines of the log:\r\n";
+  char c;
+  while ((c = pgm_read_byte(fmt++)) != '\0') {
+    if (c != '%') {
+  continue;
+    }
+    c = pgm_read_byte(fmt++);
+    if (c == '%') {
+  continue;
+    }
+    int precision;
+    LogArgSize argSize;
+    c = parseSpec(fmt, c, precision, argSize, [&](int &value) {
+      value = va_arg(ap, int);
+      if (used + sizeof(value) > outSize) {
+return false;
+      }
+      memcpy(out + used, &value, sizeof(value));
+      used += sizeof(value);
+      return true;
+    });
+    switch (c) {
+      case 's': {
+        const char *str = va_arg(ap, const char *);
+        if (str == NULL) {
+          str = "(null)";
+        }
+        const size_t len = (precision < 0) ? strlen(str) : strnlen(str, precision);
+        if (used + len + 1 > outSize) {
+return SIZE_MAX;
+        }
+        memcpy(out + used, str, len);
+        out[used + len] = '\0';
+        used += len + 1;
+      }
+      break;
+      case 'p': {
+        PACK_ARG(void *, va_arg(ap, void *));
+      }
+      break;
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+        PACK_ARG(double, va_arg(ap, double));
+      }
+      break;
+      case 'c': case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': {
+        switch (argSize) {
+          case ARG_INT: PACK_ARG(int, va_arg(ap, int)); break;
+          case ARG_LONG: PACK_ARG(long, va_arg(ap, long)); break;
+          case ARG_LONGLONG: PACK_ARG(long long, va_arg(ap, long long)); break;
+          case ARG_SIZE_T: PACK_ARG(size_t, va_arg(ap, size_t)); break;
+          default: return SIZE_MAX;
+        }
+      }
+      break;
+      case '\0': {
+        // dangling '%' at the end or no room for a star value
+return (pgm_read_byte(fmt - 1) == '\0') ? used : SIZE_MAX;
+      }
+      default: {
+        // %n and friends
+return SIZE_MAX;
+      }
+    }
+  }
+  #undef PACK_ARG
+  return used;
+}
 
-  // Get most recent half of the ring
-  for (int i = index; i < RINGLOG_SIZE; ++i) {
-    if (strlen(ringlog[i]) > 0) {
-      msg += ringlog[i];
-      msg += "\r\n";
+/**
+ * Renders fmt using the arguments stored by packArgs(). Each conversion is
+ * handed to snprintf on its own, literal text is copied.
+ * @returns count of chars written (without terminator)
+ */
+size_t Logger::renderDeferred(PGM_P fmt, const uint8_t * const args, const size_t argsLen, char * const out, const size_t outSize) {
+  size_t pos = 0;
+  size_t used = 0;
+  // false if the stored arguments are exhausted
+  auto unpack = [&](auto &value) {
+    if (used + sizeof(value) > argsLen) {
+return false;
+    }
+    memcpy(&value, args + used, sizeof(value));
+    used += sizeof(value);
+    return true;
+  };
+  char c;
+  while (pos + 1 < outSize && (c = pgm_read_byte(fmt++)) != '\0') {
+    if (c != '%') {
+      out[pos++] = c;
+  continue;
+    }
+    // Copy the specification, replacing stars with their values
+    PGM_P specStart = fmt;
+    c = pgm_read_byte(fmt++);
+    if (c == '%') {
+      out[pos++] = '%';
+  continue;
+    }
+    int stars[2];
+    uint8_t starCount = 0;
+    int precision;
+    LogArgSize argSize;
+    c = parseSpec(fmt, c, precision, argSize, [&](int &value) {
+      return unpack(value) && ((stars[starCount++] = value), true);
+    });
+    char spec[24];
+    size_t specLen = 0;
+    spec[specLen++] = '%';
+    starCount = 0;
+    for (PGM_P p = specStart; p < fmt && specLen < sizeof(spec) - 12; ++p) {
+      const char s = pgm_read_byte(p);
+      if (s == '*') {
+        specLen += snprintf(spec + specLen, sizeof(spec) - specLen, "%d", stars[starCount++]);
+      } else {
+        spec[specLen++] = s;
+      }
+    }
+    spec[specLen] = '\0';
+    int written = 0;
+    // value only provides the type to unpack
+    auto emit = [&](auto value) {
+      if (unpack(value)) {
+        written = snprintf(out + pos, outSize - pos, spec, value);
+      }
+    };
+    switch (c) {
+      case 's': {
+        const char * const str = (const char *) (args + used);
+        const size_t len = strnlen(str, argsLen - used);
+        if (len < argsLen - used) {
+          used += len + 1;
+          written = snprintf(out + pos, outSize - pos, spec, str);
+        }
+      }
+      break;
+      case 'p': {
+        emit((void *) NULL);
+      }
+      break;
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+        emit(0.0);
+      }
+      break;
+      case 'c': case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': {
+        switch (argSize) {
+          case ARG_INT: emit(0); break;
+          case ARG_LONG: emit(0L); break;
+          case ARG_LONGLONG: emit(0LL); break;
+          case ARG_SIZE_T: emit((size_t) 0); break;
+          default: break;
+        }
+      }
+      break;
+      default: {
+        // end of format or arguments exhausted, other conversions are never packed
+        out[pos] = '\0';
+return pos;
+      }
+    }
+    if (written > 0) {
+      pos += min((size_t) written, outSize - pos - 1);
     }
   }
+  out[pos] = '\0';
+  return pos;
+}
+#endif
+
+void Logger::getLog(const LogSink &sink) {
+  // header and each line go through this fixed buffer, nothing accumulates
+  char line[BUF_LEN + 2];
+  // Generate header
+  // pucgenie: microoptimization: Don't use F() here.
+  int len = snprintf(line, sizeof(line), " ==== DEBUG LOG ====\r\n\
+Chip ID: %u\r\n\
+Free Heap: %u\r\n\
+Flash Size: %u\r\n\
+Uptime: %08lu\r\n\
+Serial log lines dropped: %u\r\n\
+Printing last %u lines of the log:\r\n"
+    , ESP.getChipId()
+    , ESP.getFreeHeap()
+    , ESP.getFlashChipSize()
+    , (unsigned long) (millis() / 1000)
+    , serialTx.getDropped(TX_LOG)
+    , ringLines
+  );
+  if (len < 0 || ((unsigned int) len >= sizeof(line))) {
+    // can't use logger...
+    serialTx.println(TX_LOG, F("Header formatting broken. Continuing anyway..."));
+    len = strlen(line);
+  }
+  sink(line, len);
 
-  // Get older half of the ring
-  for (int i = 0; i < index; ++i) {
-    if (strlen(ringlog[i]) > 0) {
-      msg += ringlog[i];
-      msg += "\r\n";
+  uint8_t record[LOG_RECORD_MAX];
+#ifdef LOGGER_PERSISTENT
+  if (persistent.isEnabled()) {
+    len = snprintf(line, sizeof(line), "Boot #%u, %u records not persisted. Previous boots:\r\n", persistent.getBoot(), persistent.getDropped());
+    sink(line, len);
+    PersistentLog::Cursor cursor;
+    persistent.rewind(cursor);
+    uint8_t recordLen;
+    while ((recordLen = persistent.read(cursor, record)) > 0) {
+      if (cursor.header.boot == persistent.getBoot()) {
+    continue;
+      }
+      const int prefixLen = snprintf(line, sizeof(line), "#%u ", cursor.header.boot);
+      if (record[0] == RECORD_DEFERRED && cursor.header.build != persistent.getBuild()) {
+        // format pointers of another firmware lead nowhere
+        record[0] = RECORD_TEXT;
+        const char OTHER_BUILD[] = "(record of another firmware build)";
+        memcpy(record + LOG_RECORD_HEADER, OTHER_BUILD, sizeof(OTHER_BUILD) - 1);
+        recordLen = LOG_RECORD_HEADER + sizeof(OTHER_BUILD) - 1;
+      }
+      len = prefixLen + render(record, recordLen, line + prefixLen, BUF_LEN - prefixLen);
+      line[len++] = '\r';
+      line[len++] = '\n';
+      sink(line, len);
     }
+    const char CURRENT_BOOT[] = "Current boot:\r\n";
+    sink(CURRENT_BOOT, sizeof(CURRENT_BOOT) - 1);
+  }
+#endif
+
+  // Walk from the oldest to the most recent record
+  uint16_t offset = ringHead;
+  for (uint16_t i = ringLines; i --> 0; ) {
+    len = render(record, ringRead(offset, record), line, BUF_LEN);
+    line[len++] = '\r';
+    line[len++] = '\n';
+    sink(line, len);
   }
 
-  msg += " ==== END LOG ====\r\n";
+  const char FOOTER[] = " ==== END LOG ====\r\n";
+  sink(FOOTER, sizeof(FOOTER) - 1);
+}
+
+void Logger::getLogSince(uint32_t since, const LogSink &sink) {
+  char line[BUF_LEN + 2];
+  const uint32_t head = getHeadSeq();
+  if ((int32_t) (head - since) < 0) {
+    // from before a restart
+    since = ringFirstSeq;
+  }
+  // records that were evicted before they could be read
+  uint32_t gap = 0;
+  if ((int32_t) (since - ringFirstSeq) < 0) {
+    gap = ringFirstSeq - since;
+    since = ringFirstSeq;
+  }
+  // pucgenie: microoptimization: Don't use F() here.
+  int len = snprintf(line, sizeof(line), "head=%u gap=%u\r\n", head, gap);
+  sink(line, len);
+
+  uint16_t offset = ringHead;
+  for (uint32_t skip = since - ringFirstSeq; skip --> 0; ) {
+    offset = (offset + ringlog[offset] + 1) % RINGLOG_BYTES;
+  }
+  uint8_t record[LOG_RECORD_MAX];
+  for (uint32_t seq = since; seq != head; ++seq) {
+    const int prefixLen = snprintf(line, sizeof(line), "%u ", seq);
+    len = prefixLen + render(record, ringRead(offset, record), line + prefixLen, BUF_LEN - prefixLen);
+    line[len++] = '\r';
+    line[len++] = '\n';
+    sink(line, len);
+  }
 }
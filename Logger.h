@@ -23,9 +23,197 @@
 #define LOGGER_H
 
 #include "Arduino.h"
+#include <functional>
+#include <type_traits>
 
 #define BUF_LEN 180           // Max length of each line of log
-#define RINGLOG_SIZE 100      // Max number of line in the ring log
+#define RINGLOG_BYTES 6144    // Size of the packed ring log, ~120 lines of typical length
+#define LOG_RECORD_MAX 255    // Max length of a stored record (length prefix is one byte)
+
+/**
+If enabled, info() and debug() store the PROGMEM format pointer and the raw
+argument words. Text is only rendered when the log is read or printed to serial.
+**/
+#if 1
+#define LOGGER_DEFERRED_FORMAT
+#endif
+
+/**
+If enabled, records are also appended to reserved flash sectors (see FlashReserve.h)
+and the log of previous boots is part of getLog(). Needs a flash layout with a filesystem area.
+**/
+#if 0
+#define LOGGER_PERSISTENT
+#endif
+
+#ifdef LOGGER_PERSISTENT
+#include "PersistentLog.h"
+#endif
+
+enum LogLevel : uint8_t {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_NONE,
+};
+
+/**
+If enabled, LOG_DEBUG() calls are compiled out completely, format strings included.
+Otherwise they are still subject to the runtime debug setting.
+**/
+#ifndef LOGGER_MIN_LEVEL
+#if 0
+#define LOGGER_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOGGER_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#define LOG_RECORD_HEADER 5   // kind + millis()
+
+/**
+ * Compile-time check of printf-style formats against the argument types, see LOG_INFO().
+ * Only what packing and rendering of log records understands is accepted.
+ */
+namespace logger_format {
+
+enum ArgKind : uint8_t {
+  KIND_INTEGER,
+  KIND_FLOAT,
+  KIND_STRING,
+  KIND_POINTER,
+  KIND_OTHER,
+  KIND_END,
+};
+
+struct ArgInfo {
+  ArgKind kind;
+  uint8_t size;
+};
+
+template<typename T> constexpr ArgInfo argInfo() {
+  if constexpr (std::is_same<T, char *>::value || std::is_same<T, const char *>::value) {
+return {KIND_STRING, sizeof(T)};
+  } else if constexpr (std::is_pointer<T>::value) {
+return {KIND_POINTER, sizeof(T)};
+  } else if constexpr (std::is_floating_point<T>::value) {
+return {KIND_FLOAT, sizeof(double)};
+  } else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+    // default argument promotion
+return {KIND_INTEGER, (sizeof(T) < sizeof(int)) ? sizeof(int) : sizeof(T)};
+  } else {
+return {KIND_OTHER, sizeof(T)};
+  }
+}
+
+template<typename... Args> struct ArgList {
+  static constexpr ArgInfo value[] = { argInfo<Args>()..., {KIND_END, 0} };
+};
+
+/**
+ * Only used in unevaluated context to get the decayed argument types.
+ */
+template<typename... Args> ArgList<typename std::decay<Args>::type...> describe(Args...);
+
+constexpr bool isIntOfSize(const ArgInfo &arg, const size_t size) {
+  return arg.kind == KIND_INTEGER && arg.size == size;
+}
+
+constexpr bool matches(const char *fmt, const ArgInfo * const args) {
+  size_t a = 0;
+  while (*fmt != '\0') {
+    if (*(fmt++) != '%') {
+  continue;
+    }
+    if (*fmt == '%') {
+      ++fmt;
+  continue;
+    }
+    while (*fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '#' || *fmt == '0') {
+      ++fmt;
+    }
+    if (*fmt == '*') {
+      if (!isIntOfSize(args[a++], sizeof(int))) {
+return false;
+      }
+      ++fmt;
+    } else while (*fmt >= '0' && *fmt <= '9') {
+      ++fmt;
+    }
+    if (*fmt == '.') {
+      ++fmt;
+      if (*fmt == '*') {
+        if (!isIntOfSize(args[a++], sizeof(int))) {
+return false;
+        }
+        ++fmt;
+      } else while (*fmt >= '0' && *fmt <= '9') {
+        ++fmt;
+      }
+    }
+    size_t intSize = sizeof(int);
+    if (*fmt == 'h') {
+      fmt += (fmt[1] == 'h') ? 2 : 1;
+    } else if (*fmt == 'l') {
+      intSize = (fmt[1] == 'l') ? sizeof(long long) : sizeof(long);
+      fmt += (fmt[1] == 'l') ? 2 : 1;
+    } else if (*fmt == 'z') {
+      intSize = sizeof(size_t);
+      ++fmt;
+    }
+    const ArgInfo &arg = args[a];
+    if (arg.kind == KIND_END) {
+return false;
+    }
+    ++a;
+    switch (*(fmt++)) {
+      case 's':
+        if (arg.kind != KIND_STRING) {
+return false;
+        }
+      break;
+      case 'p':
+        if (arg.kind != KIND_POINTER) {
+return false;
+        }
+      break;
+      case 'c': case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+        if (!isIntOfSize(arg, intSize)) {
+return false;
+        }
+      break;
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        if (arg.kind != KIND_FLOAT) {
+return false;
+        }
+      break;
+      default:
+return false;
+    }
+  }
+  return args[a].kind == KIND_END;
+}
+
+}
+
+/**
+ * Checked logging front end. The format has to be a string literal, it goes to flash.
+ * Arguments are matched against it at compile time. Calls below LOGGER_MIN_LEVEL
+ * leave neither code nor strings behind.
+ */
+#define LOG_AT_LEVEL(LEVEL, FMT, ...) do { \
+    static_assert(logger_format::matches(FMT, decltype(logger_format::describe(__VA_ARGS__))::value), "log arguments don't match format: " FMT); \
+    if constexpr ((LEVEL) >= LOGGER_MIN_LEVEL) { \
+      logger.emit<LEVEL>(F(FMT), ##__VA_ARGS__); \
+    } \
+  } while (0)
+#define LOG_DEBUG(FMT, ...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, FMT, ##__VA_ARGS__)
+#define LOG_INFO(FMT, ...) LOG_AT_LEVEL(LOG_LEVEL_INFO, FMT, ##__VA_ARGS__)
+
+/**
+ * Receives the log piece by piece, see Logger::getLog(). A lambda capturing a reference
+ * fits into std::function's inline storage, no heap.
+ */
+typedef std::function<void(const char *text, size_t len)> LogSink;
 
 /**
  * This class provide a logging facility to print log messages on the 
@@ -34,25 +222,114 @@
 class Logger {
   private:
   
-    char ringlog[RINGLOG_SIZE][BUF_LEN];
-    int index;
+    /**
+     * Byte-granular ring of records. Each record is one length byte followed by
+     * that many bytes and may wrap around the end of the array.
+     * The oldest records are evicted whole to make room for new ones.
+     */
+    uint8_t ringlog[RINGLOG_BYTES];
+    uint16_t ringHead;        // Offset of the oldest record
+    uint16_t ringUsed;        // Bytes occupied by records
+    uint16_t ringLines;       // Number of records
+    uint32_t ringFirstSeq;    // Sequence number of the oldest record, the following ones are numbered without gaps
     bool enableDebug;
     bool enableSerial;
+#ifdef LOGGER_PERSISTENT
+    PersistentLog persistent;
+#endif
+
+    /**
+     * Record layout: kind (1 byte), millis() (4 bytes), payload.
+     * RECORD_TEXT payload is the message without terminator.
+     * RECORD_DEFERRED payload is the format pointer followed by the packed arguments.
+     */
+    enum RecordKind : uint8_t {
+      RECORD_TEXT,
+      RECORD_DEFERRED,
+    };
     
   public:
   
     Logger();
+    void begin();                     // Call once in setup()
+    void service();                   // Call from loop(), writes pending records to flash if LOGGER_PERSISTENT
+    void flush();                     // Write pending records to flash before a reset
     
-    void info(const __FlashStringHelper *, ...);     // Print and store message log
-    void debug(const __FlashStringHelper *, ...);    // Print and store message log if debug mode is enabled
+    void info(const __FlashStringHelper *, ...);     // Print and store message log (unchecked, prefer LOG_INFO())
+    void debug(const __FlashStringHelper *, ...);    // Print and store message log if debug mode is enabled (unchecked, prefer LOG_DEBUG())
     void logNow(const char*); // Print and store message log, no additional formatting.
     void setSerial(bool);             // Enable log output on serial port
     void setDebug(bool);              // Enable debug log output
-    void getLog(String&);              // Return the current log
+    void getLog(const LogSink &);              // Stream the current log, one line per call
+    void getLogSince(uint32_t, const LogSink &);  // Stream records starting at a sequence number, see getHeadSeq()
+    uint32_t getHeadSeq() const { return ringFirstSeq + ringLines; }  // Sequence number the next record will get
+
+    /**
+     * Use LOG_INFO()/LOG_DEBUG() instead, they check the format.
+     * With LOGGER_DEFERRED_FORMAT the typed arguments are packed directly, no format scan and no varargs.
+     */
+    template<LogLevel LEVEL, typename... Args> void emit(const __FlashStringHelper *fmt, Args... args) {
+      if constexpr (LEVEL == LOG_LEVEL_DEBUG) {
+        if (!enableDebug) {
+return;
+        }
+      }
+#ifdef LOGGER_DEFERRED_FORMAT
+      uint8_t record[LOG_RECORD_MAX];
+      record[0] = RECORD_DEFERRED;
+      const uint32_t uptime = millis();
+      memcpy(record + 1, &uptime, sizeof(uptime));
+      PGM_P const format = reinterpret_cast<PGM_P>(fmt);
+      memcpy(record + LOG_RECORD_HEADER, &format, sizeof(format));
+      size_t used = LOG_RECORD_HEADER + sizeof(format);
+      if ((packArg(record, used, args) && ...)) {
+        if (enableSerial) {
+          printRecord(record, used);
+        }
+        ringPush(record, used);
+return;
+      }
+      // Arguments don't fit into a record, format them right away.
+#endif
+      info(fmt, args...);
+    }
   
   private:
   
     void log(const __FlashStringHelper *, va_list);
+    void ringPush(const uint8_t*, uint8_t);
+    uint8_t ringRead(uint16_t&, uint8_t*) const;  // Copy record at offset into a LOG_RECORD_MAX buffer, advance offset
+    void printRecord(const uint8_t*, uint8_t);    // Render record to serial port
+    static size_t render(const uint8_t*, uint8_t, char*, size_t);  // Render record as "[millis] text"
+#ifdef LOGGER_DEFERRED_FORMAT
+    static size_t packArgs(PGM_P, va_list, uint8_t*, size_t);
+    /**
+     * Appends one typed argument the way packArgs() would.
+     * @returns false if it doesn't fit
+     */
+    template<typename T> static bool packArg(uint8_t * const record, size_t &used, const T value) {
+      if constexpr (std::is_same<T, char *>::value || std::is_same<T, const char *>::value) {
+        const char * const str = (value == NULL) ? "(null)" : value;
+        const size_t len = strlen(str);
+        if (used + len + 1 > LOG_RECORD_MAX) {
+return false;
+        }
+        memcpy(record + used, str, len + 1);
+        used += len + 1;
+      } else {
+        // default argument promotion, like passing through varargs
+        typedef typename std::conditional<std::is_floating_point<T>::value, double, decltype(+value)>::type Promoted;
+        const Promoted promoted = value;
+        if (used + sizeof(promoted) > LOG_RECORD_MAX) {
+return false;
+        }
+        memcpy(record + used, &promoted, sizeof(promoted));
+        used += sizeof(promoted);
+      }
+      return true;
+    }
+    static size_t renderDeferred(PGM_P, const uint8_t*, size_t, char*, size_t);
+#endif
     
 };
 
@@ -0,0 +1,383 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "MqttClient.h"
+#include "RemoteRelay.h"
+#include "RemoteRelay_creds.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+
+// remaining length always fits into one byte
+static_assert(MQTT_BUF_SIZE - 2 <= 127, "MQTT_BUF_SIZE too big");
+
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30
+#define MQTT_SUBSCRIBE  0x82
+#define MQTT_SUBACK     0x90
+#define MQTT_PINGREQ    0xC0
+#define MQTT_PINGRESP   0xD0
+
+/**
+ * @returns position after the length-prefixed string, nullptr if it doesn't fit before end
+ */
+static uint8_t *putString(uint8_t *p, const uint8_t * const end, const char * const s, const size_t len) {
+  if (p + 2 + len > end) {
+return nullptr;
+  }
+  *p++ = len >> 8;
+  *p++ = len;
+  memcpy(p, s, len);
+  return p + len;
+}
+
+MqttClient::MqttClient() {
+  state = MQTT_DISCONNECTED;
+  channelCount = 0;
+  dirty = 0;
+  lookupDone = false;
+  broker = 0;
+  packetId = 0;
+  lastAttempt = 0;
+  backoff = MQTT_BACKOFF_MIN_MS;
+  lastSent = 0;
+  lastReceived = 0;
+  rxHeader = 0;
+}
+
+void MqttClient::begin(const uint8_t count) {
+  if (sizeof(DEFAULT_MQTT_BROKER) == 1 || channelCount != 0) {
+    // disabled or already started
+return;
+  }
+  channelCount = min(count, (uint8_t) RELAY_NUMBER_OF_CHANNELS);
+  lastAttempt = millis() - backoff;
+}
+
+size_t MqttClient::topic(char * const buf, const size_t bufSize, const uint8_t channel, const char * const leaf) const {
+  const int len = channel == 0
+    ? snprintf(buf, bufSize, "relay/%u/%s", ESP.getChipId(), leaf)
+    : snprintf(buf, bufSize, "relay/%u/%u/%s", ESP.getChipId(), (unsigned int) channel, leaf);
+  return min((size_t) len, bufSize - 1);
+}
+
+bool MqttClient::send(const uint8_t header, const size_t len) {
+  if ((size_t) client.availableForWrite() < len + 2) {
+return false;
+  }
+  tx[0] = header;
+  tx[1] = len;
+  client.write(tx, len + 2);
+  lastSent = millis();
+  return true;
+}
+
+void MqttClient::dnsFound(const char *, const ip_addr_t * const address, void * const client) {
+  // lwIP context, service() picks it up
+  MqttClient &self = *(MqttClient *) client;
+  self.broker = (address == nullptr) ? 0 : ip4_addr_get_u32(ip_2_ip4(address));
+  self.lookupDone = true;
+}
+
+bool MqttClient::resolve() {
+  ip_addr_t address;
+  lookupDone = false;
+  switch (dns_gethostbyname(DEFAULT_MQTT_BROKER, &address, dnsFound, this)) {
+    case ERR_OK: {
+      // an address or cached
+      broker = ip4_addr_get_u32(ip_2_ip4(&address));
+      lookupDone = true;
+    }
+    break;
+    case ERR_INPROGRESS:
+    break;
+    default:
+return false;
+  }
+  state = MQTT_RESOLVING;
+  return true;
+}
+
+bool MqttClient::connect() {
+  client.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+  if (broker == 0 || !client.connect(IPAddress(broker), DEFAULT_MQTT_PORT)) {
+return false;
+  }
+  client.setNoDelay(true);
+
+  char clientId[24];
+  const int idLen = snprintf(clientId, sizeof(clientId), "RemoteRelay-%u", ESP.getChipId());
+  char willTopic[32];
+  const size_t willLen = topic(willTopic, sizeof(willTopic), 0, "status");
+
+  const uint8_t * const end = tx + sizeof(tx);
+  uint8_t *p = tx + 2;
+  p = putString(p, end, "MQTT", 4);
+  *p++ = 4;   // protocol level 3.1.1
+  uint8_t * const flags = p++;
+  *flags = 0x02 | 0x04 | 0x20;   // clean session, will, will retain
+  *p++ = MQTT_KEEPALIVE_S >> 8;
+  *p++ = MQTT_KEEPALIVE_S & 0xFF;
+  p = putString(p, end, clientId, idLen);
+  p = p ? putString(p, end, willTopic, willLen) : nullptr;
+  p = p ? putString(p, end, "offline", 7) : nullptr;
+  if (p && sizeof(DEFAULT_MQTT_USER) > 1) {
+    *flags |= 0x80;
+    p = putString(p, end, DEFAULT_MQTT_USER, sizeof(DEFAULT_MQTT_USER) - 1);
+  }
+  if (p && sizeof(DEFAULT_MQTT_PASSWORD) > 1) {
+    *flags |= 0x40;
+    p = putString(p, end, DEFAULT_MQTT_PASSWORD, sizeof(DEFAULT_MQTT_PASSWORD) - 1);
+  }
+  if (!p) {
+    LOG_INFO("{'mqtt': 'credentials too long'}");
+    client.stop();
+return false;
+  }
+  if (!send(MQTT_CONNECT, p - (tx + 2))) {
+    client.stop();
+return false;
+  }
+  state = MQTT_CONNACK_WAIT;
+  lastReceived = millis();
+  rxHeader = 0;
+  return true;
+}
+
+bool MqttClient::subscribe() {
+  char filter[32];
+  const size_t filterLen = topic(filter, sizeof(filter), 0, "+/set");
+  uint8_t *p = tx + 2;
+  ++packetId;
+  *p++ = packetId >> 8;
+  *p++ = packetId;
+  p = putString(p, tx + sizeof(tx), filter, filterLen);
+  *p++ = 0;   // QoS 0
+  return send(MQTT_SUBSCRIBE, p - (tx + 2));
+}
+
+bool MqttClient::publish(const char * const topicName, const size_t topicLen, const char * const payload, const bool retain) {
+  const size_t payloadLen = strlen(payload);
+  uint8_t *p = putString(tx + 2, tx + sizeof(tx) - payloadLen, topicName, topicLen);
+  if (!p) {
+return false;
+  }
+  memcpy(p, payload, payloadLen);
+  p += payloadLen;
+  return send(MQTT_PUBLISH | (retain ? 0x01 : 0x00), p - (tx + 2));
+}
+
+bool MqttClient::publishState(const uint8_t channel) {
+  char stateTopic[32];
+  const size_t len = topic(stateTopic, sizeof(stateTopic), channel, "state");
+  return publish(stateTopic, len, getChannel(channel) == R_CLOSE ? "on" : "off", true);
+}
+
+void MqttClient::stateChanged(const uint8_t channel) {
+  dirty |= 1 << (channel - 1);
+}
+
+void MqttClient::disconnect() {
+  client.stop();
+  state = MQTT_DISCONNECTED;
+  lastAttempt = millis();
+  LOG_INFO("{'mqtt': 'disconnected'}");
+}
+
+void MqttClient::handlePacket() {
+  switch (rxHeader & 0xF0) {
+    case MQTT_CONNACK: {
+      if (rxUsed < 2 || rx[1] != 0) {
+        LOG_INFO("{'mqtt': 'connection refused', 'returnCode': %u}", (unsigned int) (rxUsed < 2 ? 0xFF : rx[1]));
+        backoff = min(backoff * 2, (uint32_t) MQTT_BACKOFF_MAX_MS);
+        disconnect();
+return;
+      }
+      state = MQTT_CONNECTED;
+      backoff = MQTT_BACKOFF_MIN_MS;
+      LOG_INFO("{'mqtt': 'connected'}");
+      char statusTopic[32];
+      const size_t len = topic(statusTopic, sizeof(statusTopic), 0, "status");
+      // fresh connection, the send buffer has room for these
+      publish(statusTopic, len, "online", true);
+      subscribe();
+      dirty = (1 << channelCount) - 1;
+    }
+    break;
+    case MQTT_PUBLISH: {
+      if (rxUsed < 2) {
+return;
+      }
+      const size_t topicLen = rx[0] << 8 | rx[1];
+      // skip the packet identifier of QoS 1 and 2
+      const size_t payloadStart = 2 + topicLen + ((rxHeader & 0x06) ? 2 : 0);
+      if (payloadStart > rxUsed) {
+return;
+      }
+      char prefix[24];
+      const size_t prefixLen = topic(prefix, sizeof(prefix), 0, "");
+      const char * const name = (const char *) rx + 2;
+      if (topicLen <= prefixLen || memcmp(name, prefix, prefixLen) != 0) {
+return;
+      }
+      unsigned int channel = 0;
+      size_t i = prefixLen;
+      for (; i < topicLen && isdigit(name[i]) && channel <= RELAY_NUMBER_OF_CHANNELS; ++i) {
+        channel = channel * 10 + (name[i] - '0');
+      }
+      if (topicLen - i != 4 || memcmp(name + i, "/set", 4) != 0) {
+return;
+      }
+      const char * const payload = (const char *) rx + payloadStart;
+      const size_t payloadLen = rxUsed - payloadStart;
+      RSTM32Mode mode;
+      if ((payloadLen == 2 && memcmp(payload, "on", 2) == 0) || (payloadLen == 1 && payload[0] == '1')) {
+        mode = R_CLOSE;
+      } else if ((payloadLen == 3 && memcmp(payload, "off", 3) == 0) || (payloadLen == 1 && payload[0] == '0')) {
+        mode = R_OPEN;
+      } else {
+        LOG_DEBUG("{'mqtt': 'invalid mode'}");
+return;
+      }
+      if (channel < 1 || channel > channelCount) {
+        LOG_DEBUG("{'mqtt': 'invalid channel', 'channel': %u}", channel);
+return;
+      }
+      timerWheel.cancel(channel);
+      relayQueue.request(channel, mode);
+    }
+    break;
+    case MQTT_SUBACK: {
+      if (rxUsed >= 3 && rx[2] == 0x80) {
+        LOG_INFO("{'mqtt': 'subscription refused'}");
+      }
+    }
+    break;
+    default:
+      // PINGRESP
+    break;
+  }
+}
+
+void MqttClient::receive() {
+  if (client.available() > 0) {
+    lastReceived = millis();
+  }
+  while (client.available() > 0) {
+    const uint8_t b = client.read();
+    if (rxHeader == 0) {
+      // packet type 0 is reserved, so 0 means no packet started
+      rxHeader = b;
+      rxRemaining = 0;
+      rxLengthShift = 0;
+      rxInLength = true;
+  continue;
+    }
+    if (rxInLength) {
+      rxRemaining |= (uint32_t) (b & 0x7F) << rxLengthShift;
+      rxLengthShift += 7;
+      if (b & 0x80) {
+        if (rxLengthShift > 21) {
+          LOG_INFO("{'mqtt': 'malformed packet'}");
+          disconnect();
+return;
+        }
+  continue;
+      }
+      rxInLength = false;
+      rxUsed = 0;
+    } else {
+      if (rxUsed < sizeof(rx)) {
+        rx[rxUsed] = b;
+      }
+      ++rxUsed;
+      --rxRemaining;
+    }
+    if (rxRemaining == 0) {
+      if (rxUsed <= sizeof(rx)) {
+        handlePacket();
+      } else {
+        LOG_DEBUG("{'mqtt': 'packet too big', 'length': %u}", rxUsed);
+      }
+      rxHeader = 0;
+      if (state == MQTT_DISCONNECTED) {
+return;
+      }
+    }
+  }
+}
+
+void MqttClient::service() {
+  if (channelCount == 0) {
+return;
+  }
+  if (state == MQTT_DISCONNECTED) {
+    if (WiFi.status() != WL_CONNECTED || millis() - lastAttempt < backoff) {
+return;
+    }
+    lastAttempt = millis();
+    if (!resolve()) {
+      LOG_DEBUG("{'mqtt': 'lookup failed', 'retryMs': %u}", backoff);
+      backoff = min(backoff * 2, (uint32_t) MQTT_BACKOFF_MAX_MS);
+    }
+return;
+  }
+  if (state == MQTT_RESOLVING) {
+    if (!lookupDone && millis() - lastAttempt < MQTT_DNS_TIMEOUT_MS) {
+return;
+    }
+    state = MQTT_DISCONNECTED;
+    if (!lookupDone || !connect()) {
+      LOG_DEBUG("{'mqtt': 'connect failed', 'retryMs': %u}", backoff);
+      backoff = min(backoff * 2, (uint32_t) MQTT_BACKOFF_MAX_MS);
+    }
+return;
+  }
+  if (!client.connected()) {
+    disconnect();
+return;
+  }
+  receive();
+  // after receive(), which updates lastReceived
+  const uint32_t now = millis();
+  if (state == MQTT_CONNACK_WAIT) {
+    if (now - lastReceived > MQTT_CONNACK_TIMEOUT_MS) {
+      disconnect();
+    }
+return;
+  }
+  if (state != MQTT_CONNECTED) {
+return;
+  }
+  if (now - lastReceived > MQTT_KEEPALIVE_S * 1500UL) {
+    // neither data nor PINGRESP within 1.5 keep-alive periods
+    disconnect();
+return;
+  }
+  for (uint8_t channel = 1; dirty != 0 && channel <= channelCount; ++channel) {
+    const uint8_t bit = 1 << (channel - 1);
+    if ((dirty & bit) && publishState(channel)) {
+      dirty &= ~bit;
+    }
+  }
+  if (now - lastSent > MQTT_KEEPALIVE_S * 500UL) {
+    send(MQTT_PINGREQ, 0);
+  }
+}
@@ -0,0 +1,101 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef MQTTCLIENT_H
+#define MQTTCLIENT_H
+
+#include <ESP8266WiFi.h>
+#include <lwip/dns.h>
+
+#define MQTT_KEEPALIVE_S 60
+#define MQTT_DNS_TIMEOUT_MS 5000      // Give up on a broker name lookup, it doesn't block meanwhile
+#define MQTT_CONNECT_TIMEOUT_MS 200   // Upper bound for the blocking part of a connection attempt
+#define MQTT_CONNACK_TIMEOUT_MS 5000
+#define MQTT_BACKOFF_MIN_MS 1000
+#define MQTT_BACKOFF_MAX_MS 60000
+#define MQTT_BUF_SIZE 128             // Largest packet sent or received, bigger incoming ones are skipped
+
+/**
+ * Minimal MQTT 3.1.1 client, QoS 0 only.
+ *
+ * Topics, with the decimal chip id:
+ *   relay/<chipid>/status      retained "online", "offline" as will
+ *   relay/<chipid>/<n>/state   retained "on" or "off", published after every change
+ *   relay/<chipid>/<n>/set     subscribed, "on" or "off" switches channel n
+ *
+ * Changes are only marked by stateChanged() and published from service() when the TCP send
+ * buffer has room, so a slow broker coalesces them instead of blocking. All states are
+ * published again after each (re)connect. The broker name is looked up asynchronously through
+ * lwIP before each attempt, its cache answers right away while the entry is valid.
+ */
+class MqttClient {
+  private:
+    enum State : uint8_t {
+      MQTT_DISCONNECTED,
+      MQTT_RESOLVING,
+      MQTT_CONNACK_WAIT,
+      MQTT_CONNECTED,
+    };
+
+    WiFiClient client;
+    State state;
+    uint8_t channelCount;
+    uint8_t dirty;                // Channels whose state has to be published, channel 1 is bit 0
+    volatile bool lookupDone;     // Set by the lookup's callback
+    volatile uint32_t broker;     // Its result, 0 if the name wasn't found
+    uint16_t packetId;
+    uint32_t lastAttempt;
+    uint32_t backoff;
+    uint32_t lastSent;
+    uint32_t lastReceived;
+
+    // receive state of the current incoming packet
+    uint8_t rxHeader;
+    uint32_t rxRemaining;
+    uint8_t rxLengthShift;
+    uint32_t rxUsed;              // May exceed sizeof(rx), the packet is skipped then
+    bool rxInLength;
+    uint8_t rx[MQTT_BUF_SIZE];
+
+    uint8_t tx[MQTT_BUF_SIZE];
+
+    size_t topic(char *buf, size_t bufSize, uint8_t channel, const char *leaf) const;
+    bool send(uint8_t header, size_t len);
+    static void dnsFound(const char *name, const ip_addr_t *address, void *client);
+    bool resolve();                       // Start the lookup, false if it failed right away
+    bool connect();
+    bool subscribe();
+    bool publish(const char *topic, size_t topicLen, const char *payload, bool retain);
+    bool publishState(uint8_t channel);
+    void receive();
+    void handlePacket();
+    void disconnect();
+
+  public:
+    MqttClient();
+    void begin(uint8_t channelCount);
+    void stateChanged(uint8_t channel);   // Called for every state change
+    void service();                       // Connect, receive and publish, call from loop()
+    bool isConnected() const { return state == MQTT_CONNECTED; }
+};
+
+extern MqttClient mqttClient;
+
+#endif  // MQTTCLIENT_H
@@ -0,0 +1,105 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef PERFECTHASH_H
+#define PERFECTHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Perfect hash over a fixed list of keywords, built at compile time.
+ *
+ * The constructor searches a seed for which FNV-1a puts every key into its own slot
+ * of a 2^BITS table. A lookup hashes the input once and compares it with the single
+ * candidate key, no allocation and no String involved.
+ *
+ * Usage with an X-macro list:
+ *   static constexpr const char *KEYS[] = { FOREACH(GENERATE_STRING) };
+ *   static constexpr PerfectHash<sizeof(KEYS) / sizeof(KEYS[0]), 5> HASH(KEYS);
+ *   HASH.find(text, len)   // index into KEYS (= the enum value), or the key count
+ */
+template<size_t N, uint8_t BITS>
+class PerfectHash {
+  private:
+    static constexpr size_t SLOTS = (size_t) 1 << BITS;
+    static constexpr uint8_t EMPTY = 0xFF;
+    static_assert(N < EMPTY && N <= SLOTS, "too many keys for the table");
+
+    const char *keys[N] = {};
+    uint8_t lens[N] = {};
+    uint8_t slots[SLOTS] = {};
+    uint32_t seed = 0;
+
+    static constexpr size_t length(const char * const s) {
+      size_t len = 0;
+      while (s[len] != '\0') {
+        ++len;
+      }
+      return len;
+    }
+
+    static constexpr size_t slot(const uint32_t seed, const char * const s, const size_t len) {
+      uint32_t h = seed;
+      for (size_t i = 0; i < len; ++i) {
+        h = (h ^ (uint8_t) s[i]) * 16777619u;
+      }
+      return h >> (32 - BITS);
+    }
+
+  public:
+    constexpr PerfectHash(const char * const (&list)[N]) {
+      for (size_t i = 0; i < N; ++i) {
+        keys[i] = list[i];
+        lens[i] = length(list[i]);
+      }
+      // FNV offset basis first; fails to compile if no seed works (constexpr loop limit)
+      for (seed = 2166136261u; ; ++seed) {
+        for (size_t i = 0; i < SLOTS; ++i) {
+          slots[i] = EMPTY;
+        }
+        size_t i = 0;
+        for (; i < N; ++i) {
+          const size_t s = slot(seed, keys[i], lens[i]);
+          if (slots[s] != EMPTY) {
+        break;
+          }
+          slots[s] = i;
+        }
+        if (i == N) {
+      break;
+        }
+      }
+    }
+
+    /**
+     * @returns index of the key equal to the first len chars of s, N if there's none
+     */
+    size_t find(const char * const s, const size_t len) const {
+      const uint8_t i = slots[slot(seed, s, len)];
+      if (i == EMPTY || lens[i] != len || memcmp(keys[i], s, len) != 0) {
+return N;
+      }
+      return i;
+    }
+};
+
+#endif  // PERFECTHASH_H
@@ -0,0 +1,232 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "PersistentLog.h"
+#include "RemoteRelaySettings.h"
+#include "SerialTx.h"
+
+#define ENTRY_SIZE(len) ((2 + (len) + 3) & ~3)
+
+PersistentLog::PersistentLog() {
+  firstSector = 0;
+  sequence = 0;
+  boot = 0;
+  build = 0;
+  page = 0;
+  pageOffset = 0;
+  eraseNeeded = false;
+  pendingHead = 0;
+  pendingUsed = 0;
+  pendingSince = 0;
+  dropped = 0;
+}
+
+void PersistentLog::begin() {
+  firstSector = flash_reserve_sector(FLASH_RESERVE_PERSISTENT_LOG);
+  if (firstSector == 0) {
+return;
+  }
+  {
+    // computed once, cached by the core
+    const String md5 = ESP.getSketchMD5();
+    build = strtoul(md5.substring(0, 4).c_str(), NULL, 16);
+  }
+
+  // Find the newest page, each boot continues on the following one
+  int16_t newest = -1;
+  PageHeader header;
+  for (uint8_t p = 0; p < PERSISTLOG_PAGES; ++p) {
+    if (readHeader(p, header) && (newest < 0 || (int32_t) (header.sequence - sequence) > 0)) {
+      newest = p;
+      sequence = header.sequence;
+      boot = header.boot;
+    }
+  }
+  if (newest < 0) {
+    // blank or foreign content
+    page = 0;
+    eraseNeeded = true;
+return;
+  }
+  ++sequence;
+  ++boot;
+  page = (newest + 1) % PERSISTLOG_PAGES;
+  if (page % FLASH_PAGES_PER_SECTOR != 0) {
+    uint32_t raw[sizeof(PageHeader) / sizeof(uint32_t)];
+    ESP.flashRead((firstSector * FLASH_SECTOR_SIZE) + (page * FLASH_PAGE_SIZE), raw, sizeof(raw));
+    for (uint8_t i = sizeof(raw) / sizeof(raw[0]); i --> 0; ) {
+      if (raw[i] != 0xFFFFFFFF) {
+        // not erased, continue with the next sector
+        page = (page + FLASH_PAGES_PER_SECTOR - (page % FLASH_PAGES_PER_SECTOR)) % PERSISTLOG_PAGES;
+    break;
+      }
+    }
+  }
+  eraseNeeded = (page % FLASH_PAGES_PER_SECTOR) == 0;
+}
+
+bool PersistentLog::append(const uint8_t * const record, const uint8_t len) {
+  if (firstSector == 0) {
+return false;
+  }
+  const uint16_t needed = len + 1;
+  if ((size_t) ENTRY_SIZE(len) > FLASH_PAGE_SIZE - sizeof(PageHeader) || PERSISTLOG_PENDING_BYTES - pendingUsed < needed) {
+    ++dropped;
+return false;
+  }
+  if (pendingUsed == 0) {
+    pendingSince = millis();
+  }
+  uint16_t tail = (pendingHead + pendingUsed) % PERSISTLOG_PENDING_BYTES;
+  pending[tail] = len;
+  tail = (tail + 1) % PERSISTLOG_PENDING_BYTES;
+  const uint16_t firstPart = min((uint16_t) len, (uint16_t) (PERSISTLOG_PENDING_BYTES - tail));
+  memcpy(pending + tail, record, firstPart);
+  memcpy(pending, record + firstPart, len - firstPart);
+  pendingUsed += needed;
+  return true;
+}
+
+/**
+ * Moves as many pending records as fit into the page image.
+ * @returns new end offset within the page
+ */
+uint16_t PersistentLog::fillPage(uint8_t * const out, uint16_t offset) {
+  if (offset == 0) {
+    const PageHeader header = {
+      .sequence = sequence,
+      .boot = boot,
+      .build = build,
+      .magic = PERSISTLOG_MAGIC,
+    };
+    memcpy(out, &header, sizeof(header));
+    offset = sizeof(header);
+  }
+  while (pendingUsed > 0) {
+    const uint8_t len = pending[pendingHead];
+    const uint16_t entry = ENTRY_SIZE(len);
+    if (offset + entry > FLASH_PAGE_SIZE) {
+  break;
+    }
+    const uint16_t start = (pendingHead + 1) % PERSISTLOG_PENDING_BYTES;
+    const uint16_t firstPart = min((uint16_t) len, (uint16_t) (PERSISTLOG_PENDING_BYTES - start));
+    memcpy(out + offset + 2, pending + start, firstPart);
+    memcpy(out + offset + 2 + firstPart, pending, len - firstPart);
+    out[offset] = len;
+    out[offset + 1] = RemoteRelaySettings::crc8(out + offset + 2, len);
+    // padding stays erased
+    memset(out + offset + 2 + len, 0xFF, entry - 2 - len);
+    offset += entry;
+    pendingHead = (pendingHead + len + 1) % PERSISTLOG_PENDING_BYTES;
+    pendingUsed -= len + 1;
+  }
+  return offset;
+}
+
+void PersistentLog::service() {
+  if (firstSector == 0 || pendingUsed == 0) {
+return;
+  }
+  if (pendingUsed < PERSISTLOG_FLUSH_BYTES && millis() - pendingSince < PERSISTLOG_FLUSH_MS) {
+return;
+  }
+  writeStep();
+}
+
+void PersistentLog::flush() {
+  while (firstSector != 0 && pendingUsed > 0) {
+    writeStep();
+  }
+}
+
+void PersistentLog::writeStep() {
+  if (eraseNeeded) {
+    // the only slow operation, once per FLASH_PAGES_PER_SECTOR pages
+    ESP.flashEraseSector(firstSector + (page / FLASH_PAGES_PER_SECTOR));
+    eraseNeeded = false;
+return;
+  }
+
+  uint32_t image[FLASH_PAGE_SIZE / sizeof(uint32_t)];
+  const uint16_t start = pageOffset;
+  const uint16_t end = fillPage((uint8_t *) image, start);
+  if (end > start && !ESP.flashWrite((firstSector * FLASH_SECTOR_SIZE) + (page * FLASH_PAGE_SIZE) + start, image + (start / sizeof(uint32_t)), end - start)) {
+    // can't use logger...
+    serialTx.println(TX_LOG, F("Persistent log write failed."));
+  }
+  pageOffset = end;
+  pendingSince = millis();
+
+  if (pendingUsed > 0) {
+    // the next record didn't fit, continue on a fresh page
+    page = (page + 1) % PERSISTLOG_PAGES;
+    ++sequence;
+    pageOffset = 0;
+    eraseNeeded = (page % FLASH_PAGES_PER_SECTOR) == 0;
+  }
+}
+
+bool PersistentLog::readHeader(const uint8_t p, PageHeader &header) const {
+  ESP.flashRead((firstSector * FLASH_SECTOR_SIZE) + (p * FLASH_PAGE_SIZE), (uint32_t *) &header, sizeof(header));
+  return header.magic == PERSISTLOG_MAGIC;
+}
+
+void PersistentLog::rewind(Cursor &cursor) const {
+  // pages are written round robin, the oldest is the one after the current page. Until the
+  // current page gets its header it may still hold the oldest data (a sector not erased yet).
+  cursor.pagesLeft = (firstSector == 0) ? 0 : PERSISTLOG_PAGES;
+  cursor.page = (pageOffset == 0) ? (page + PERSISTLOG_PAGES - 1) % PERSISTLOG_PAGES : page;
+  cursor.offset = 0;
+}
+
+uint8_t PersistentLog::read(Cursor &cursor, uint8_t * const record) const {
+  const uint8_t * const bytes = (const uint8_t *) cursor.data;
+  while (true) {
+    if (cursor.offset == 0) {
+      if (cursor.pagesLeft == 0) {
+return 0;
+      }
+      --cursor.pagesLeft;
+      cursor.page = (cursor.page + 1) % PERSISTLOG_PAGES;
+      ESP.flashRead((firstSector * FLASH_SECTOR_SIZE) + (cursor.page * FLASH_PAGE_SIZE), cursor.data, FLASH_PAGE_SIZE);
+      memcpy(&cursor.header, bytes, sizeof(cursor.header));
+      if (cursor.header.magic != PERSISTLOG_MAGIC) {
+    continue;
+      }
+      cursor.offset = sizeof(PageHeader);
+    }
+    const uint8_t len = bytes[cursor.offset];
+    const uint16_t entry = ENTRY_SIZE(len);
+    // end of page, or a record torn by a reset during programming
+    if (len == 0xFF || cursor.offset + entry > FLASH_PAGE_SIZE
+        || bytes[cursor.offset + 1] != RemoteRelaySettings::crc8(bytes + cursor.offset + 2, len)) {
+      cursor.offset = 0;
+  continue;
+    }
+    memcpy(record, bytes + cursor.offset + 2, len);
+    cursor.offset += entry;
+    if (cursor.offset >= FLASH_PAGE_SIZE) {
+      cursor.offset = 0;
+    }
+return len;
+  }
+}
+
+#undef ENTRY_SIZE
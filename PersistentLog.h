@@ -0,0 +1,98 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef PERSISTENTLOG_H
+#define PERSISTENTLOG_H
+
+#include <Arduino.h>
+#include "FlashReserve.h"
+
+#define PERSISTLOG_PENDING_BYTES 512    // RAM buffer for records not yet in flash
+#define PERSISTLOG_FLUSH_BYTES 64       // Program as soon as this much is pending...
+#define PERSISTLOG_FLUSH_MS 2000        // ...or the oldest pending record is this old
+#define PERSISTLOG_PAGES (FLASH_RESERVE_PERSISTENT_LOG_SECTORS * FLASH_PAGES_PER_SECTOR)
+#define PERSISTLOG_MAGIC 0x474C5252     // "RRLG"
+
+/**
+ * Appends log records to reserved flash sectors so they survive resets.
+ *
+ * Each boot starts a new 256 Byte page with a header (sequence, boot counter, build tag).
+ * Records follow as [len][crc8][bytes] padded to 4 Bytes, erased flash (len 0xFF) ends a page.
+ * Pages are programmed incrementally into erased space, a sector is only erased when the
+ * write position enters it. So wear depends on the amount of logged data, not on how often
+ * it is flushed. service() does at most one page program or one sector erase per call.
+ */
+class PersistentLog {
+  public:
+    struct PageHeader {
+      uint32_t sequence;
+      uint16_t boot;
+      uint16_t build;         // records with PROGMEM pointers are only readable by the same build
+      uint32_t magic;         // tells pages apart from foreign flash content
+    };
+
+    /**
+     * Reading position, see read().
+     */
+    struct Cursor {
+      uint8_t pagesLeft;
+      uint8_t page;
+      uint16_t offset;
+      PageHeader header;
+      uint32_t data[FLASH_PAGE_SIZE / sizeof(uint32_t)];
+    };
+
+  private:
+    uint32_t firstSector;
+    uint32_t sequence;        // of the page being written
+    uint16_t boot;
+    uint16_t build;
+    uint8_t page;             // being written, relative to firstSector
+    uint16_t pageOffset;      // next free byte in page, 0 if the page header isn't written yet
+    bool eraseNeeded;
+
+    // byte ring of [len][record] like Logger's
+    uint8_t pending[PERSISTLOG_PENDING_BYTES];
+    uint16_t pendingHead;
+    uint16_t pendingUsed;
+    uint32_t pendingSince;
+    uint16_t dropped;
+
+  public:
+    PersistentLog();
+    void begin();                                       // Find the write position, call once in setup()
+    bool append(const uint8_t *record, uint8_t len);    // Queue a record, false if dropped
+    void service();                                     // Write queued records, call from loop()
+    void flush();                                       // Write all queued records now, before a reset
+    uint16_t getBoot() const { return boot; }
+    uint16_t getBuild() const { return build; }
+    uint16_t getDropped() const { return dropped; }
+    bool isEnabled() const { return firstSector != 0; }
+
+    void rewind(Cursor &) const;                        // Start reading at the oldest page
+    uint8_t read(Cursor &, uint8_t *record) const;      // Next record (LOG_RECORD_MAX buffer), 0 at the end
+
+  private:
+    bool readHeader(uint8_t page, PageHeader &) const;
+    uint16_t fillPage(uint8_t *out, uint16_t offset);
+    void writeStep();                                   // One sector erase or page program
+};
+
+#endif  // PERSISTENTLOG_H
@@ -0,0 +1,108 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "RelayQueue.h"
+
+RelayQueue::RelayQueue() {
+  for (uint8_t i = RELAY_NUMBER_OF_CHANNELS; i --> 0; ) {
+    target[i] = R_OPEN;
+    requested[i] = 0;
+    // first switching is never deferred
+    lastSwitch[i] = 0 - RELAY_MIN_INTERVAL_MS;
+  }
+  pendingMask = 0;
+  noops = 0;
+  merged = 0;
+  deferred = 0;
+}
+
+void RelayQueue::request(const uint8_t channel, const RSTM32Mode mode) {
+  RSTM32Mode modes[RELAY_NUMBER_OF_CHANNELS];
+  modes[channel - 1] = mode;
+  request(modes, 1 << (channel - 1));
+}
+
+void RelayQueue::request(const RSTM32Mode * const modes, const uint8_t mask) {
+  const uint32_t now = millis();
+  for (uint8_t i = 0; i < RELAY_NUMBER_OF_CHANNELS; ++i) {
+    const uint8_t bit = 1 << i;
+    if (!(mask & bit)) {
+  continue;
+    }
+    if (pendingMask & bit) {
+      if (target[i] == modes[i]) {
+        ++noops;
+      } else {
+        // may be the current state again, service() drops it then
+        target[i] = modes[i];
+        ++merged;
+      }
+    } else if (modes[i] == getChannel(i + 1)) {
+      ++noops;
+    } else {
+      target[i] = modes[i];
+      requested[i] = now;
+      pendingMask |= bit;
+      if (now - lastSwitch[i] < RELAY_MIN_INTERVAL_MS) {
+        ++deferred;
+      }
+    }
+  }
+  // no need to wait for the next loop()
+  service();
+}
+
+void RelayQueue::service() {
+  if (pendingMask == 0) {
+return;
+  }
+  const uint32_t now = millis();
+  uint8_t due = 0;
+  for (uint8_t i = 0; i < RELAY_NUMBER_OF_CHANNELS; ++i) {
+    const uint8_t bit = 1 << i;
+    if (!(pendingMask & bit) || now - requested[i] < RELAY_COALESCE_MS) {
+  continue;
+    }
+    if (target[i] == getChannel(i + 1)) {
+      // toggled back
+      pendingMask &= ~bit;
+  continue;
+    }
+    if (now - lastSwitch[i] < RELAY_MIN_INTERVAL_MS) {
+  continue;
+    }
+    due |= bit;
+    pendingMask &= ~bit;
+    lastSwitch[i] = now;
+  }
+  if (due != 0) {
+    setChannels(target, due);
+  }
+}
+
+int RelayQueue::getStats(char * const buffer, const size_t bufSize) const {
+  // pucgenie: microoptimization: Don't use F() here.
+  return snprintf(buffer, bufSize, "Relay requests dropped: %u, merged: %u, deferred: %u, pending mask: 0x%02X\r\n"
+    , noops
+    , merged
+    , deferred
+    , pendingMask
+  );
+}
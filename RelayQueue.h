@@ -0,0 +1,59 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef RELAYQUEUE_H
+#define RELAYQUEUE_H
+
+#include "RemoteRelay.h"
+
+#define RELAY_COALESCE_MS 0           // Wait this long for further requests on a channel, only the final state is sent
+#define RELAY_MIN_INTERVAL_MS 250     // Minimum time between two switching operations of a channel
+
+/**
+ * Sits between the front ends and setChannels().
+ *
+ * Requests for the state a channel already has are dropped. Requests arriving while
+ * one is pending for the same channel replace it, so a burst of toggles ends up as its
+ * final state (or nothing, if that's the current state). Switching a channel again is
+ * deferred until RELAY_MIN_INTERVAL_MS has passed. Everything due at the same time
+ * goes out as one burst.
+ */
+class RelayQueue {
+  private:
+    RSTM32Mode target[RELAY_NUMBER_OF_CHANNELS];
+    uint32_t requested[RELAY_NUMBER_OF_CHANNELS];    // millis() of the first pending request
+    uint32_t lastSwitch[RELAY_NUMBER_OF_CHANNELS];
+    uint8_t pendingMask;                              // channel 1 is bit 0
+
+    uint16_t noops;           // Requests for the current state
+    uint16_t merged;          // Requests replacing a pending one
+    uint16_t deferred;        // Requests delayed by the minimum interval
+
+  public:
+    RelayQueue();
+    void request(uint8_t channel, RSTM32Mode mode);
+    void request(const RSTM32Mode *modes, uint8_t mask);  // Like setChannels()
+    void service();                                       // Send what is due, call from loop()
+    int getStats(char *buffer, size_t bufSize) const;     // Counters as text line
+};
+
+extern RelayQueue relayQueue;
+
+#endif  // RELAYQUEUE_H
@@ -44,6 +44,23 @@ If enabled, remove not-that-often-used strings from RAM.
 #define LOWMEMORY_STR
 #endif
 
+/**
+If enabled, channel states are journaled to reserved flash sectors (see FlashReserve.h)
+and restored at boot. Otherwise all relays are turned off at boot.
+**/
+#if 0
+#define RELAY_STATE_JOURNAL
+#endif
+
+/**
+If enabled, a raw TCP port speaks the stock LCTech binary frames (see BinaryControl.h).
+It has no authentication at all, like the stock firmware. Only clients in the local subnet
+are accepted, but anyone there can switch the relays.
+**/
+#if 0
+#define BINARY_CONTROL_PORT 8080
+#endif
+
 #include "Logger.h"
 #include "RemoteRelaySettings.h"
 
@@ -64,6 +81,9 @@ If enabled, remove not-that-often-used strings from RAM.
     #define RELAY_NUMBER_OF_CHANNELS 2
   #endif
 #endif
+// channelBits(), RelayQueue, StateJournal, Groups and the UDP ack hold channel masks in a byte,
+// PUT /channels takes single-digit channel ids
+static_assert(RELAY_NUMBER_OF_CHANNELS >= 1 && RELAY_NUMBER_OF_CHANNELS <= 8, "channel masks are uint8_t");
 
 //#define DISABLE NUVOTON_AT_REPLIES      // https://github.com/nagius/RemoteRelay/issues/4 (uncomment to disable feature)
 #ifndef DISABLE_NUVOTON_AT_REPLIES
@@ -116,6 +136,19 @@ enum MyPingState {
   PING_TIMEOUT,
 };
 
+/**
+HTTP/1.1 keep-alive of WebFrontEnd and the portal's web server: a connection is closed after
+being idle for HTTP_KEEPALIVE_IDLE_MS or after HTTP_KEEPALIVE_MAX_REQUESTS requests (the last
+response says "Connection: close"). The core closes idle connections of the portal's server
+after HTTP_MAX_CLOSE_WAIT anyway.
+**/
+#ifndef HTTP_KEEPALIVE_IDLE_MS
+#define HTTP_KEEPALIVE_IDLE_MS 2000
+#endif
+#ifndef HTTP_KEEPALIVE_MAX_REQUESTS
+#define HTTP_KEEPALIVE_MAX_REQUESTS 100
+#endif
+
 // Used for string buffers
 #define BUF_SIZE 384
 // TODO: Create a manager for retrieving and returning buffers?
@@ -140,6 +173,21 @@ enum RSTM32Mode {
 };
 
 void setChannel(const uint8_t channel, const RSTM32Mode mode);
+RSTM32Mode getChannel(const uint8_t channel);
+/**
+ * Channel 1 is bit 0, set if R_CLOSE.
+**/
+uint8_t channelBits();
+/**
+ * Switches the channels whose bit (channel 1 is bit 0) is set in mask to modes[channel - 1],
+ * their frames are sent in one burst.
+**/
+void setChannels(const RSTM32Mode * const modes, const uint8_t mask);
+/**
+ * Changes with every switching operation and settings change, starts at 0 on boot.
+**/
+uint32_t getStateGeneration();
+void bumpStateGeneration();
 //void saveSettings(RemoteRelaySettings &p_settings, uint16_t &p_settings_offset);
 void eeprom_destroy_crc(uint16_t &old_addr);
 // Doesn't need to be visible yet.
@@ -149,5 +197,15 @@ void eeprom_destroy_crc(uint16_t &old_addr);
  * @returns count of chars written (without terminator)
 **/
 size_t getJSONState(const uint8_t channel, char * const p_buffer, const size_t bufSize);
+/**
+ * Server-Sent Event with the JSON state of the channel.
+ * @returns count of chars written (without terminator)
+**/
+size_t getEventState(const uint8_t channel, char * const p_buffer, const size_t bufSize);
+/**
+ * JSON array of all channel states.
+ * @returns count of chars written (without terminator)
+**/
+size_t getJSONStates(char * const p_buffer, const size_t bufSize);
 
 #endif  // REMOTERELAY_H
@@ -41,6 +41,21 @@ Seldomly used strings (subjective measurement) are always PSTR.
 #include <AsyncPing.h>
 
 #include "RemoteRelay.h"
+#include "SerialTx.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+#include "Schedules.h"
+#include "Groups.h"
+#include "EventStream.h"
+#include "UdpControl.h"
+#include "MqttClient.h"
+#include "WebFrontEnd.h"
+#ifdef RELAY_STATE_JOURNAL
+#include "StateJournal.h"
+#endif
+#ifdef BINARY_CONTROL_PORT
+#include "BinaryControl.h"
+#endif
 char buffer[2][BUF_SIZE];
 
 #include "WebHelper.h"
@@ -53,6 +68,21 @@ char buffer[2][BUF_SIZE];
 
 RemoteRelaySettings settings;
 Logger logger;
+SerialTx serialTx;
+RelayQueue relayQueue;
+TimerWheel timerWheel;
+Schedules schedules;
+Groups groups;
+EventStream eventStream;
+UdpControl udpControl;
+MqttClient mqttClient;
+WebFrontEnd webFrontEnd(80);
+#ifdef RELAY_STATE_JOURNAL
+StateJournal stateJournal;
+#endif
+#ifdef BINARY_CONTROL_PORT
+BinaryControl binaryControl(BINARY_CONTROL_PORT);
+#endif
 bool shouldSaveConfig   = false;
 MyLoopState myLoopState = AFTER_SETUP;
 MyWiFiState myWiFiState = MYWIFI_OFF;
@@ -94,6 +124,8 @@ static auto channels = make_array<RELAY_NUMBER_OF_CHANNELS>(R_OPEN);
 
 static uint16_t settings_offset = 0;
 
+static uint32_t stateGeneration = 0;
+
 /**
  * Flash memory helpers 
  ********************************************************************************/
@@ -109,8 +141,23 @@ struct RSTM32Payload {
   RSTM32Mode mode  :8;
   uint8_t checksum :8;
 };
+static_assert(sizeof(RSTM32Payload) == 4, "frames are sent back to back");
 
-void setChannel(const uint8_t channel, const RSTM32Mode mode) {
+/**
+ * Called for every state change, also if it's the same state again.
+ */
+static void onChannelChanged(const uint8_t channel) {
+  bumpStateGeneration();
+  char event[64];
+  const size_t len = getEventState(channel, event, sizeof(event));
+  eventStream.publish(event, len);
+  mqttClient.stateChanged(channel);
+}
+
+/**
+ * Saves the new state and builds the frame for it.
+ */
+static RSTM32Payload prepareChannel(const uint8_t channel, const RSTM32Mode mode) {
   struct RSTM32Payload payload = {
     .channel = channel,
     .mode = mode,
@@ -122,25 +169,71 @@ void setChannel(const uint8_t channel, const RSTM32Mode mode) {
   //assert(sizeof(channels) <= 9, "print functions are restricted to one-digit channel count");
   // Save status 
   channels[channel - 1] = mode;
+  onChannelChanged(channel);
   
-  logger.info(F("{'channel': %c, 'state': '%.3s'}"), channel + '0', (mode == R_CLOSE) ? "on" : "off");
+  LOG_INFO("{'channel': %c, 'state': '%.3s'}", channel + '0', (mode == R_CLOSE) ? "on" : "off");
   {
     const uint8_t *payload_bytes = (const uint8_t *) &payload;
     // TODO: Is it little-endian or big-endian ...
-    logger.debug(F("{'payload': '%02X%02X%02X%02X'}"), payload_bytes[0], payload_bytes[1], payload_bytes[2], payload_bytes[3]);
-  
-    // Give some time to the watchdog
-    ESP.wdtFeed();
-    yield();
-    
-    // Send payload
-    // TODO: Is it little-endian or big-endian ...
-    Serial.write(payload_bytes, sizeof(payload));
+    LOG_DEBUG("{'payload': '%02X%02X%02X%02X'}", payload_bytes[0], payload_bytes[1], payload_bytes[2], payload_bytes[3]);
   }
+  return payload;
+}
+
+uint8_t channelBits() {
+  uint8_t bits = 0;
+  for (uint8_t i = channels.size(); i --> 0; ) {
+    bits = (bits << 1) | (channels[i] == R_CLOSE);
+  }
+  return bits;
+}
+
+RSTM32Mode getChannel(const uint8_t channel) {
+  return channels[channel - 1];
+}
+
+void setChannel(const uint8_t channel, const RSTM32Mode mode) {
+  const struct RSTM32Payload payload = prepareChannel(channel, mode);
+#ifdef RELAY_STATE_JOURNAL
+  stateJournal.append(channelBits());
+#endif
+
+  // Give some time to the watchdog
+  ESP.wdtFeed();
+  yield();
   
-  if (settings.flags.serial) {
-    Serial.println(); // Clear the line for log output
+  // Send payload, ahead of any log output
+  // TODO: Is it little-endian or big-endian ...
+  serialTx.write(TX_FRAME, (const uint8_t *) &payload, sizeof(payload));
+}
+
+void setChannels(const RSTM32Mode * const modes, const uint8_t mask) {
+  struct RSTM32Payload payloads[RELAY_NUMBER_OF_CHANNELS];
+  uint8_t count = 0;
+  for (uint8_t channel = 1; channel <= channels.size(); ++channel) {
+    if (mask & (1 << (channel - 1))) {
+      payloads[count++] = prepareChannel(channel, modes[channel - 1]);
+    }
   }
+#ifdef RELAY_STATE_JOURNAL
+  // one record for the whole burst
+  stateJournal.append(channelBits());
+#endif
+
+  // Give some time to the watchdog
+  ESP.wdtFeed();
+  yield();
+
+  // One message, so the frames go out back to back
+  serialTx.write(TX_FRAME, (const uint8_t *) payloads, count * sizeof(payloads[0]));
+}
+
+uint32_t getStateGeneration() {
+  return stateGeneration;
+}
+
+void bumpStateGeneration() {
+  ++stateGeneration;
 }
 
 size_t getJSONState(const uint8_t channel, char * const p_buffer, const size_t bufSize) {
@@ -154,12 +247,41 @@ size_t getJSONState(const uint8_t channel, char * const p_buffer, const size_t b
   return snstatus;
 }
 
+size_t getEventState(const uint8_t channel, char * const p_buffer, const size_t bufSize) {
+  const char PREFIX[] = "data: ";
+  memcpy(p_buffer, PREFIX, sizeof(PREFIX) - 1);
+  size_t len = sizeof(PREFIX) - 1;
+  // JSON ends with a line break already
+  len += getJSONState(channel, p_buffer + len, bufSize - len);
+  assert(len + 1 < bufSize);
+  p_buffer[len++] = '\n';
+  p_buffer[len] = '\0';
+  return len;
+}
+
+size_t getJSONStates(char * const p_buffer, const size_t bufSize) {
+  size_t pos = 0;
+  p_buffer[pos++] = '[';
+  for (uint8_t channel = 1; channel <= channels.size(); ++channel) {
+    pos += ULTRALOWMEMORY_FUNC(p_buffer + pos, bufSize - pos, ULTRALOWMEMORY_STR(R"=="==(%s{"channel":%.1i,"mode":"%.3s"})=="==")
+      , (channel == 1) ? "" : ","
+      , channel
+      , (channels[channel - 1] == R_CLOSE) ? "on" : "off"
+    );
+    assert(pos < bufSize);
+  }
+  pos += ULTRALOWMEMORY_FUNC(p_buffer + pos, bufSize - pos, ULTRALOWMEMORY_STR("]\n"));
+  assert(pos < bufSize);
+  return pos;
+}
+
 //void configModeCallback(WiFiManager *myWiFiManager) {
 //  
 //}
 
 void setup()  {
   Serial.begin(115200);
+  logger.begin();
 
 /*
   // TODO: compile-time initialization possible
@@ -173,9 +295,9 @@ void setup()  {
   
   // Load settings from flash
   if (settings.loadSettings(settings_offset)) {
-    logger.info(F("{'RemoteRelay': '%s'}"), REMOTERELAY_VERSION);
+    LOG_INFO("{'RemoteRelay': '%s'}", REMOTERELAY_VERSION);
   } else {
-    logger.info(F("{'RemoteRelay': '%s', 'mode': 'failsafe'}"), REMOTERELAY_VERSION);
+    LOG_INFO("{'RemoteRelay': '%s', 'mode': 'failsafe'}", REMOTERELAY_VERSION);
   }
   // nop - don't need to save defaults in error case because they can be restored anytime. Save write cycles.
   
@@ -183,14 +305,31 @@ void setup()  {
   wifiManager.setConfigPortalBlocking(false);
   wifiManager.setRemoveDuplicateAPs(true);
 
+#ifdef RELAY_STATE_JOURNAL
+  {
+    uint8_t restored;
+    if (stateJournal.begin(restored)) {
+      for (uint8_t i = channels.size(); i --> 0; ) {
+        channels[i] = (restored & (1 << i)) ? R_CLOSE : R_OPEN;
+      }
+      LOG_INFO("{'restoredStates': %u}", (unsigned int) restored);
+    }
+  }
+  // Be sure the relays are in the journaled state (or NC, off)
+#else
   // Be sure the relays are in the default state (NC, off)
+#endif
   #pragma clang loop unroll(full)
   //#pragma GCC unroll 4
-  for (int8_t i = sizeof(channels); i > 0; --i) {
+  for (int8_t i = channels.size(); i > 0; --i) {
     // pucgenie: (i, --i) would violate -Wsequence-point
     setChannel(i, channels[i - 1]);
   }
 
+  // SNTP starts by itself once WiFi is up
+  schedules.begin();
+  groups.begin();
+
   // don't think about freeing these resources if not using them - we would need to implement a good reset mechanism...
   {
     const WiFiManagerParameter webparams[] = {
@@ -246,13 +385,17 @@ void loop() {
     break;
     // pucgenie: fully implemented
     case SHUTDOWN_HALT: {
-      logger.info(F("{'action': 'powering down'}"));
+      LOG_INFO("{'action': 'powering down'}");
+      logger.flush();
+      serialTx.flush();
       ESP.deepSleep(0);
     }
     break;
     // pucgenie: fully implemented
     case SHUTDOWN_RESTART: {
-      logger.info(F("{'action': 'restarting'}"));
+      LOG_INFO("{'action': 'restarting'}");
+      logger.flush();
+      serialTx.flush();
       ESP.restart();
     }
     break;
@@ -265,7 +408,7 @@ void loop() {
     }
     break;
     case RESTORE: {
-      logger.info(F("{'action': 'destroying settings in EEPROM...'}"));
+      LOG_INFO("{'action': 'destroying settings in EEPROM...'}");
       myLoopState = EEPROM_DESTROY_CRC;
     }
     break;
@@ -276,7 +419,7 @@ void loop() {
     }
     break;
     default: {
-      logger.info(F("{'LoopState': 'invalid'}"));
+      LOG_INFO("{'LoopState': 'invalid'}");
       led_scream(0b10010010);
       myLoopState = SHUTDOWN_REQUESTED;
     }
@@ -361,19 +504,26 @@ void loop() {
     // TODO: don't assume WiFiManager portal is running!
     case WEB_REQUESTED:
       // Display local ip
-      logger.info(F("{'IPAddress': '%s'}"), WiFi.localIP().toString().c_str());
+      LOG_INFO("{'IPAddress': '%s'}", WiFi.localIP().toString().c_str());
 
-      if (settings.flags.webservice) {
-        setup_web_handlers(sizeof(channels));
-        /* wifiManager handles server
-        server.begin();
-        */
-      }
-      
       if (settings.flags.wifimanager_portal || (myWiFiState == AP_MODE && (!settings.flags.webservice))) {
         wifiManager.startWebPortal();
       }
-      logger.info(F("{'HTTPServer': 'started'}"));
+      if (settings.flags.webservice) {
+        // through the portal's server if it runs, it owns port 80 then
+        setup_web_handlers(channels.size());
+        if (!wifiManager.server) {
+          webFrontEnd.begin(dispatch_web_request);
+        }
+        udpControl.begin(channels.size());
+      }
+      mqttClient.begin(channels.size());
+#ifdef BINARY_CONTROL_PORT
+      // the port requested by AT+CIPSERVER on the stock firmware
+      binaryControl.begin(channels.size());
+      LOG_INFO("{'binaryControl': 'listening', 'port': %u}", (unsigned int) BINARY_CONTROL_PORT);
+#endif
+      LOG_INFO("{'HTTPServer': 'started', 'portal': %.5s}", bool2str((bool) wifiManager.server));
       
       myWebState = WEB_FULL;
     break;
@@ -384,6 +534,7 @@ void loop() {
       server.handleClient();
       */
       wifiManager.process();
+      service_web_keepalive();
       if (shouldSaveConfig) {
         myLoopState = SAVE_SETTINGS;
       }
@@ -396,7 +547,7 @@ void loop() {
 
 #ifndef DISABLE_NUVOTON_AT_REPLIES
   if (serial_response_next) {
-    Serial.println(serial_response_next);
+    serialTx.println(TX_REPLY, serial_response_next);
     serial_response_next = NULL;
   }
   if (myLoopState == AFTER_SETUP) {
@@ -414,7 +565,7 @@ void loop() {
           myLoopState = RESET;
             // pretend we reset (wait a bit then send the WiFi connected message)
             delay(10);
-            Serial.println(F("WIFI CONNECTED\r\nWIFI GOT IP"));
+            serialTx.println(TX_REPLY, F("WIFI CONNECTED\r\nWIFI GOT IP"));
         }
         break;
         case at_replies::CWMODE_1: {
@@ -464,11 +615,27 @@ void loop() {
       at_previous = at_current;
     }
     if (serial_response_next) {
-      Serial.println(serial_response_next);
+      serialTx.println(TX_REPLY, serial_response_next);
       serial_response_next = NULL;
     }
   }
 #endif
+
+  schedules.service();
+#ifdef BINARY_CONTROL_PORT
+  binaryControl.service();
+#endif
+  udpControl.service();
+  webFrontEnd.service();
+  timerWheel.service();
+#ifdef RELAY_STATE_JOURNAL
+  stateJournal.service();
+#endif
+  relayQueue.service();
+  serialTx.service();
+  eventStream.service();
+  mqttClient.service();
+  logger.service();
 }
 
 
@@ -37,6 +37,28 @@ extern "C" {
 #define SETTINGS_FLASH_OVERADDR FLASH_SECTOR_SIZE - (SETTINGS_FLASH_SIZE)
 #define SETTINGS_FLASH_WEARLEVEL_MARK_BITS GET_BIT_FIELD_WIDTH(ST_SETTINGS_FLAGS, wearlevel_mark)
 
+char RemoteRelaySettings::authToken[AUTHBASIC_LEN_TOKEN + 1];
+uint8_t RemoteRelaySettings::authTokenLen = 0;
+
+/**
+ * @returns count of chars written to out (without terminator), which needs 4 * ((len + 2) / 3) + 1
+ */
+static size_t base64(const char * const in, const size_t len, char * const out) {
+  static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t o = 0;
+  for (size_t i = 0; i < len; i += 3) {
+    const uint32_t bits = (uint8_t) in[i] << 16
+      | (i + 1 < len ? (uint8_t) in[i + 1] << 8 : 0)
+      | (i + 2 < len ? (uint8_t) in[i + 2] : 0);
+    out[o++] = ALPHABET[bits >> 18 & 0x3F];
+    out[o++] = ALPHABET[bits >> 12 & 0x3F];
+    out[o++] = i + 1 < len ? ALPHABET[bits >> 6 & 0x3F] : '=';
+    out[o++] = i + 2 < len ? ALPHABET[bits & 0x3F] : '=';
+  }
+  out[o] = '\0';
+  return o;
+}
+
 /**
  * Reads settings from EEPROM flash into this object.
  * Returns the byte start location of the loaded settings block.
@@ -67,7 +89,7 @@ bool RemoteRelaySettings::loadSettings(uint16_t &the_address) {
     }
   }
   if (!ret) {
-    logger.info(F("{'settings': 'loading default'}"));
+    LOG_INFO("{'settings': 'loading default'}");
     //setDefaultSettings(*this);
     strncpy_P(this->login, PSTR(DEFAULT_LOGIN), AUTHBASIC_LEN_USERNAME+1);
     strncpy_P(this->password, PSTR(DEFAULT_PASSWORD), AUTHBASIC_LEN_PASSWORD+1);
@@ -85,10 +107,11 @@ bool RemoteRelaySettings::loadSettings(uint16_t &the_address) {
     the_address = 0;
   } else {
     // serial is disabled by default, so spare us another if after setting
-    logger.info(F("{'settings': 'loaded from flash'}"));
+    LOG_INFO("{'settings': 'loaded from flash'}");
   }
   // could have changed
   logger.setSerial(this->flags.serial);
+  this->updateAuthToken();
 
   // Display loaded setting on debug
   if (this->flags.debug) {
@@ -114,7 +137,7 @@ void RemoteRelaySettings::saveSettings(uint16_t &p_settings_offset) {
     this->flags.erase_cycles += 1;
     // check wrap-around / overflow
     if (this->flags.erase_cycles == 0) {
-      logger.info(F("{'settings': 'more than 256 erase cycles of settings block reached'}"));
+      LOG_INFO("{'settings': 'more than 256 erase cycles of settings block reached'}");
     }
     p_settings_offset = 0;
     //TODO: erase sector explicitly or keep using EEPROM class' auto-detection?
@@ -122,6 +145,29 @@ void RemoteRelaySettings::saveSettings(uint16_t &p_settings_offset) {
   EEPROM.put(p_settings_offset, *this);
   EEPROM.put(p_settings_offset + sizeof(RemoteRelaySettings), theCRC);
   EEPROM.commit();
+  // also changed through WiFiManager's parameters
+  this->updateAuthToken();
+  bumpStateGeneration();
+}
+
+void RemoteRelaySettings::updateAuthToken() {
+  char credentials[AUTHBASIC_LEN_USERNAME + 1 + AUTHBASIC_LEN_PASSWORD + 1];
+  // login and password may fill their arrays without terminator
+  const int len = snprintf(credentials, sizeof(credentials), "%.*s:%.*s"
+    , AUTHBASIC_LEN_USERNAME, this->login
+    , AUTHBASIC_LEN_PASSWORD, this->password
+  );
+  authTokenLen = base64(credentials, min((size_t) len, sizeof(credentials) - 1), authToken);
+}
+
+bool RemoteRelaySettings::isAuthToken(const char * const token) const {
+  // only the client's own token length shows in the timing
+  const size_t len = strnlen(token, AUTHBASIC_LEN_TOKEN + 1);
+  uint8_t diff = len != authTokenLen;
+  for (uint8_t i = 0; i < authTokenLen; ++i) {
+    diff |= authToken[i] ^ token[i < len ? i : 0];
+  }
+  return diff == 0;
 }
 
 size_t RemoteRelaySettings::getJSONSettings(char * const p_buffer, const size_t bufSize) {
@@ -26,6 +26,8 @@
 
 #define AUTHBASIC_LEN_USERNAME 20        // Login or password 20 char max
 #define AUTHBASIC_LEN_PASSWORD 20        // Login or password 20 char max
+// base64 of "login:password"
+#define AUTHBASIC_LEN_TOKEN (4 * ((AUTHBASIC_LEN_USERNAME + 1 + AUTHBASIC_LEN_PASSWORD + 2) / 3))
 #define LENGTH_SSID 32
 #define LENGTH_WPA_KEY 64
 
@@ -80,7 +82,11 @@ class RemoteRelaySettings {
   
   private:
   
-    ;
+    /**
+     * Expected Authorization token, static so it isn't part of the stored settings block.
+     */
+    static char authToken[AUTHBASIC_LEN_TOKEN + 1];
+    static uint8_t authTokenLen;
     
   public:
   
@@ -104,6 +110,16 @@ class RemoteRelaySettings {
     * @returns count of chars written (without terminator)
     **/
     size_t getJSONSettings(char * const buffer, const size_t bufSize);
+    /**
+     * Computes the token checked by isAuthToken(), needs to be called after login or password changed.
+     * Done by loadSettings() and saveSettings().
+     */
+    void updateAuthToken();
+    /**
+     * Compares in constant time, without depending on where the token differs.
+     * @param token the Authorization header's value after "Basic "
+     */
+    bool isAuthToken(const char *token) const;
   
   private:
   
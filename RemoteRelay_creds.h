@@ -4,5 +4,13 @@
 #define DEFAULT_PASSWORD "MtsssezPzg"
 #define DEFAULT_STANDALONE_SSID "RemoteRelay"
 #define DEFAULT_STANDALONE_WPA_KEY "1234x5678"
+// Time for schedules, TZ in POSIX format
+#define DEFAULT_NTP_SERVER "pool.ntp.org"
+#define DEFAULT_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
+// MQTT broker, empty to disable. IP address or name, names are looked up in the background (up to MQTT_DNS_TIMEOUT_MS).
+#define DEFAULT_MQTT_BROKER ""
+#define DEFAULT_MQTT_PORT 1883
+#define DEFAULT_MQTT_USER ""
+#define DEFAULT_MQTT_PASSWORD ""
 
 // TODO: use ESP.getEfuseMac() - even if it's sometimes trivial for an attacker to find out the device's MAC address
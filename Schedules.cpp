@@ -0,0 +1,149 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "Schedules.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+
+Schedules::Schedules() {
+  memset(&table, 0, sizeof(table));
+  sector = 0;
+  nextFire = 0;
+  nextMinute = 0;
+  lastService = 0;
+}
+
+void Schedules::begin() {
+  configTime(DEFAULT_TZ, DEFAULT_NTP_SERVER);
+
+  sector = flash_reserve_sector(FLASH_RESERVE_SCHEDULES);
+  if (sector == 0) {
+    LOG_INFO("{'schedules': 'no flash reserved'}");
+return;
+  }
+  ESP.flashRead(sector * FLASH_SECTOR_SIZE, (uint32_t *) &table, sizeof(table));
+  if (table.magic != SCHEDULES_MAGIC || table.count > SCHEDULES_MAX
+      || table.crc != RemoteRelaySettings::crc8((const uint8_t *) table.entries, table.count * sizeof(ScheduleEntry))) {
+    // erased or damaged, start empty
+    memset(&table, 0, sizeof(table));
+  }
+  LOG_INFO("{'schedules': %u}", (unsigned int) table.count);
+}
+
+bool Schedules::isTimeValid() const {
+  return time(nullptr) > SCHEDULES_TIME_VALID;
+}
+
+void Schedules::save() {
+  table.magic = SCHEDULES_MAGIC;
+  table.crc = RemoteRelaySettings::crc8((const uint8_t *) table.entries, table.count * sizeof(ScheduleEntry));
+  // rarely changed, rewriting the whole sector is fine
+  ESP.flashEraseSector(sector);
+  ESP.flashWrite(sector * FLASH_SECTOR_SIZE, (const uint32_t *) &table, sizeof(table));
+  nextFire = 0;
+}
+
+bool Schedules::add(const ScheduleEntry &entry) {
+  if (sector == 0 || table.count >= SCHEDULES_MAX) {
+return false;
+  }
+  table.entries[table.count++] = entry;
+  save();
+  return true;
+}
+
+bool Schedules::remove(const uint8_t i) {
+  if (i >= table.count) {
+return false;
+  }
+  memmove(table.entries + i, table.entries + i + 1, (table.count - i - 1) * sizeof(ScheduleEntry));
+  --table.count;
+  save();
+  return true;
+}
+
+void Schedules::computeNext(const time_t now) {
+  struct tm local;
+  localtime_r(&now, &local);
+  const uint16_t current = (local.tm_wday * 24 + local.tm_hour) * 60 + local.tm_min;
+  uint16_t best = SCHEDULES_MINUTES_PER_WEEK;
+  for (uint8_t i = table.count; i --> 0; ) {
+    const ScheduleEntry &entry = table.entries[i];
+    for (uint8_t day = 7; day --> 0; ) {
+      if (!(entry.weekdays & (1 << day))) {
+    continue;
+      }
+      uint16_t delta = ((day * 24 + entry.hour) * 60 + entry.minute + SCHEDULES_MINUTES_PER_WEEK - current) % SCHEDULES_MINUTES_PER_WEEK;
+      if (delta == 0) {
+        // the current minute is either done or too late
+        delta = SCHEDULES_MINUTES_PER_WEEK;
+      }
+      best = min(best, delta);
+    }
+  }
+  // without schedules this just rechecks in a week
+  nextFire = now - local.tm_sec + best * 60L;
+  nextMinute = (current + best) % SCHEDULES_MINUTES_PER_WEEK;
+}
+
+void Schedules::service() {
+  const time_t now = time(nullptr);
+  if (now <= SCHEDULES_TIME_VALID) {
+return;
+  }
+  if (now < lastService) {
+    // clock stepped back
+    nextFire = 0;
+  }
+  lastService = now;
+  if (nextFire == 0) {
+    computeNext(now);
+return;
+  }
+  if (now < nextFire) {
+return;
+  }
+
+  RSTM32Mode modes[RELAY_NUMBER_OF_CHANNELS];
+  uint8_t mask = 0;
+  for (uint8_t i = 0; i < table.count; ++i) {
+    const ScheduleEntry &entry = table.entries[i];
+    if (entry.channel < 1 || entry.channel > RELAY_NUMBER_OF_CHANNELS) {
+      // saved by a build with more channels
+  continue;
+    }
+    const uint8_t day = nextMinute / (24 * 60);
+    if ((entry.weekdays & (1 << day)) && entry.hour * 60 + entry.minute == nextMinute % (24 * 60)) {
+      // later entries win
+      modes[entry.channel - 1] = (RSTM32Mode) entry.mode;
+      mask |= 1 << (entry.channel - 1);
+    }
+  }
+  if (mask != 0) {
+    LOG_INFO("{'schedule': %u, 'mask': %u}", (unsigned int) nextMinute, (unsigned int) mask);
+    for (uint8_t channel = RELAY_NUMBER_OF_CHANNELS; channel > 0; --channel) {
+      if (mask & (1 << (channel - 1))) {
+        timerWheel.cancel(channel);
+      }
+    }
+    relayQueue.request(modes, mask);
+  }
+  computeNext(now);
+}
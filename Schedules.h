@@ -0,0 +1,87 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef SCHEDULES_H
+#define SCHEDULES_H
+
+#include "RemoteRelay.h"
+#include "FlashReserve.h"
+
+#define SCHEDULES_MAX 32
+#define SCHEDULES_MAGIC 0x43535252        // "RRSC"
+#define SCHEDULES_MINUTES_PER_WEEK (7 * 24 * 60)
+#define SCHEDULES_TIME_VALID 1700000000   // Anything earlier means SNTP hasn't synced yet
+
+/**
+ * One weekly switching time, local time.
+ */
+struct ScheduleEntry {
+  uint8_t weekdays;         // bit 0 is Sunday, like tm_wday
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t channel :7;
+  uint8_t mode    :1;       // RSTM32Mode
+};
+
+/**
+ * Weekly schedules, kept in a reserved flash sector. Time comes from SNTP.
+ *
+ * The next due minute is computed whenever schedules fire or change, so service()
+ * only compares the clock against it. Missed minutes (no time yet, long stall)
+ * are not caught up.
+ */
+class Schedules {
+  private:
+    /**
+     * Flash image of the table.
+     */
+    struct Storage {
+      uint32_t magic;
+      uint8_t count;
+      uint8_t crc;          // crc8 of the used entries
+      uint16_t reserved;
+      ScheduleEntry entries[SCHEDULES_MAX];
+    };
+
+    Storage table;
+    uint32_t sector;
+    time_t nextFire;        // 0 if it has to be computed
+    uint16_t nextMinute;    // of the week, when nextFire is reached
+    time_t lastService;
+
+  public:
+    Schedules();
+    void begin();                                       // Load table, start SNTP, call once in setup()
+    void service();                                     // Fire due schedules, call from loop()
+    bool isEnabled() const { return sector != 0; }
+    bool isTimeValid() const;
+    uint8_t getCount() const { return table.count; }
+    const ScheduleEntry &get(uint8_t i) const { return table.entries[i]; }
+    bool add(const ScheduleEntry &);                    // false if the table is full
+    bool remove(uint8_t i);                             // false if there's no such entry
+
+  private:
+    void save();
+    void computeNext(time_t now);
+};
+
+extern Schedules schedules;
+
+#endif  // SCHEDULES_H
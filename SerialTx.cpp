@@ -0,0 +1,164 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "SerialTx.h"
+
+SerialTx::SerialTx() {
+  uint8_t * const bytes[TX_CLASSES] = {frameBytes, replyBytes, logBytes};
+  const uint16_t sizes[TX_CLASSES] = {SERIALTX_FRAME_BYTES, SERIALTX_REPLY_BYTES, SERIALTX_LOG_BYTES};
+  for (uint8_t i = TX_CLASSES; i --> 0; ) {
+    rings[i] = {
+      .bytes = bytes[i],
+      .size = sizes[i],
+      .head = 0,
+      .used = 0,
+      .sent = 0,
+      .dropped = 0,
+    };
+  }
+  current = TX_CLASSES;
+  lineBreaks = false;
+  needLineBreak = false;
+}
+
+bool SerialTx::begin(const TxClass cls, const uint8_t len) {
+  Ring &ring = rings[cls];
+  if (len + 1 > ring.size) {
+    ++ring.dropped;
+return false;
+  }
+  while (ring.size - ring.used < len + 1) {
+    if (cls == TX_LOG) {
+      ++ring.dropped;
+return false;
+    }
+    // frames and replies must not get lost, wait for the UART
+    service();
+    yield();
+  }
+  push(ring, &len, 1);
+  return true;
+}
+
+void SerialTx::push(Ring &ring, const uint8_t * const data, const uint8_t len) {
+  const uint16_t tail = (ring.head + ring.used) % ring.size;
+  // Second part is only non-empty if the message wraps around the end
+  const uint16_t firstPart = min((uint16_t) len, (uint16_t) (ring.size - tail));
+  memcpy(ring.bytes + tail, data, firstPart);
+  memcpy(ring.bytes, data + firstPart, len - firstPart);
+  ring.used += len;
+}
+
+bool SerialTx::write(const TxClass cls, const uint8_t * const data, const uint8_t len) {
+  if (!begin(cls, len)) {
+return false;
+  }
+  push(rings[cls], data, len);
+  // get frames out right away
+  service();
+  return true;
+}
+
+bool SerialTx::println(const TxClass cls, const char * const text) {
+  const uint8_t len = strnlen(text, UINT8_MAX - 2);
+  if (!begin(cls, len + 2)) {
+return false;
+  }
+  push(rings[cls], (const uint8_t *) text, len);
+  push(rings[cls], (const uint8_t *) "\r\n", 2);
+  service();
+  return true;
+}
+
+bool SerialTx::println(const TxClass cls, const __FlashStringHelper * const text) {
+  char copy[UINT8_MAX - 1];
+  strncpy_P(copy, (PGM_P) text, sizeof(copy) - 1);
+  copy[sizeof(copy) - 1] = '\0';
+  return println(cls, copy);
+}
+
+void SerialTx::service() {
+  int room = Serial.availableForWrite();
+  while (room > 0) {
+    TxClass cls;
+    if (current != TX_CLASSES) {
+      // don't interleave anything with a started frame or reply
+      cls = current;
+    } else if (rings[TX_FRAME].used > 0) {
+      cls = TX_FRAME;
+    } else if (rings[TX_LOG].sent > 0) {
+      // only frames may cut into a log line, the MCU finds them by their header
+      cls = TX_LOG;
+    } else {
+      for (cls = TX_FRAME; cls < TX_CLASSES && rings[cls].used == 0; cls = (TxClass) (cls + 1)) {
+      }
+      if (cls == TX_CLASSES) {
+return;
+      }
+    }
+    Ring &ring = rings[cls];
+    if (cls != TX_FRAME && needLineBreak) {
+      if (ring.sent > 0) {
+        // resumed log line ends the line itself
+        needLineBreak = false;
+      } else {
+        // Clear the line after binary frames
+        if (room < 2) {
+return;
+        }
+        Serial.write((const uint8_t *) "\r\n", 2);
+        room -= 2;
+        needLineBreak = false;
+      }
+    }
+    const uint8_t len = ring.bytes[ring.head];
+    const uint16_t start = (ring.head + 1 + ring.sent) % ring.size;
+    const uint16_t n = min(min((uint16_t) (len - ring.sent), (uint16_t) (ring.size - start)), (uint16_t) room);
+    Serial.write(ring.bytes + start, n);
+    room -= n;
+    ring.sent += n;
+    if (ring.sent < len) {
+      if (cls != TX_LOG) {
+        current = cls;
+      }
+  continue;
+    }
+    ring.head = (ring.head + 1 + len) % ring.size;
+    ring.used -= 1 + len;
+    ring.sent = 0;
+    current = TX_CLASSES;
+    if (cls == TX_FRAME) {
+      needLineBreak = lineBreaks;
+    }
+  }
+}
+
+void SerialTx::flush() {
+  while (rings[TX_FRAME].used > 0 || rings[TX_REPLY].used > 0 || rings[TX_LOG].used > 0) {
+    service();
+    yield();
+  }
+  Serial.flush();
+}
+
+void SerialTx::setLineBreaks(const bool on) {
+  lineBreaks = on;
+  needLineBreak &= on;
+}
@@ -0,0 +1,89 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef SERIALTX_H
+#define SERIALTX_H
+
+#include <Arduino.h>
+
+// Ring sizes per priority class, each message costs one more byte
+#define SERIALTX_FRAME_BYTES 64       // 12 relay frames
+#define SERIALTX_REPLY_BYTES 128
+#define SERIALTX_LOG_BYTES 512
+
+/**
+ * Priority classes, lower value goes out first.
+ */
+enum TxClass : uint8_t {
+  TX_FRAME,     // RSTM32Payload for the relay MCU
+  TX_REPLY,     // AT replies
+  TX_LOG,       // Log output, dropped if the UART falls behind
+  TX_CLASSES,
+};
+
+/**
+ * Non-blocking scheduler for everything written to Serial.
+ *
+ * Messages are queued whole per priority class. service() only writes as much as the
+ * UART FIFO takes (availableForWrite()), so the loop never waits for the 115200 baud line.
+ * Frames and AT replies are never interleaved with anything once started. Only frames
+ * may cut into a log line, an AT reply waits for the line end. After a frame a line break
+ * goes out before the next reply or log line so the binary bytes don't garble the terminal,
+ * but only while the log is printed to serial (setLineBreaks()).
+ * Frames and replies are never dropped, queueing them waits for room if necessary. Only
+ * messages larger than their ring are, they would never fit.
+ */
+class SerialTx {
+  private:
+    struct Ring {
+      uint8_t *bytes;
+      uint16_t size;
+      uint16_t head;        // Offset of the oldest message (its length byte)
+      uint16_t used;
+      uint8_t sent;         // Bytes of the oldest message already written
+      uint16_t dropped;
+    };
+
+    uint8_t frameBytes[SERIALTX_FRAME_BYTES];
+    uint8_t replyBytes[SERIALTX_REPLY_BYTES];
+    uint8_t logBytes[SERIALTX_LOG_BYTES];
+    Ring rings[TX_CLASSES];
+    TxClass current;          // Class of a partially written frame or reply, TX_CLASSES if none
+    bool lineBreaks;
+    bool needLineBreak;
+
+  public:
+    SerialTx();
+    bool write(TxClass, const uint8_t *, uint8_t);          // Queue one message, false if dropped
+    bool println(TxClass, const char *);                    // Queue a message with CRLF appended
+    bool println(TxClass, const __FlashStringHelper *);
+    void service();                                         // Write as much as the UART takes, call from loop()
+    void flush();                                           // Block until everything is written
+    void setLineBreaks(bool);                               // Clear the line after frames, for a terminal
+    uint16_t getDropped(TxClass cls) const { return rings[cls].dropped; }
+
+  private:
+    bool begin(TxClass, uint8_t);                           // Queue the length byte of a message if there's room for it
+    void push(Ring &, const uint8_t *, uint8_t);            // Append bytes to the message being queued
+};
+
+extern SerialTx serialTx;
+
+#endif  // SERIALTX_H
@@ -0,0 +1,130 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "StateJournal.h"
+#include "RemoteRelay.h"
+
+static_assert(sizeof(StateJournal::Record) == 4, "flash is programmed in words");
+
+StateJournal::StateJournal() {
+  firstSector = 0;
+  current = 0;
+  next = 0;
+  sequence = 0;
+  states = 0;
+  eraseOther = false;
+}
+
+uint32_t StateJournal::address(const uint8_t sector, const uint16_t index) const {
+  return (firstSector + sector) * FLASH_SECTOR_SIZE + index * sizeof(Record);
+}
+
+bool StateJournal::readRecord(const uint8_t sector, const uint16_t index, Record &record) const {
+  ESP.flashRead(address(sector, index), (uint32_t *) &record, sizeof(record));
+  // erased flash could have a matching crc
+  return (record.sequence != 0xFFFF || record.states != 0xFF)
+      && record.crc == RemoteRelaySettings::crc8((const uint8_t *) &record, offsetof(Record, crc));
+}
+
+bool StateJournal::isErased(const uint8_t sector, const uint16_t index) const {
+  uint32_t raw;
+  ESP.flashRead(address(sector, index), &raw, sizeof(raw));
+  return raw == 0xFFFFFFFF;
+}
+
+bool StateJournal::begin(uint8_t &restored) {
+  firstSector = flash_reserve_sector(FLASH_RESERVE_STATE_JOURNAL);
+  if (firstSector == 0) {
+return false;
+  }
+  Record first[FLASH_RESERVE_STATE_JOURNAL_SECTORS];
+  const bool valid[] = {readRecord(0, 0, first[0]), readRecord(1, 0, first[1])};
+  if (!valid[0] && !valid[1]) {
+    // blank or foreign content
+    if (!isErased(0, 0)) {
+      ESP.flashEraseSector(firstSector);
+    }
+    // the first append() takes care of the other sector
+    current = 0;
+    next = 0;
+return false;
+  }
+  current = (valid[0] && valid[1]) ? ((int16_t) (first[1].sequence - first[0].sequence) > 0) : valid[1];
+
+  // Records are programmed in order, find the last one that isn't erased
+  uint16_t lo = 0;
+  uint16_t hi = STATEJOURNAL_RECORDS;
+  while (hi - lo > 1) {
+    const uint16_t mid = (lo + hi) / 2;
+    if (isErased(current, mid)) {
+      hi = mid;
+    } else {
+      lo = mid;
+    }
+  }
+  next = lo + 1;
+
+  // torn writes are not reused, the newest intact record before them counts
+  Record record;
+  while (!readRecord(current, lo, record)) {
+    --lo;
+  }
+  states = record.states;
+  sequence = record.sequence + 1;
+  eraseOther = !isErased(current ^ 1, 0);
+  restored = states;
+  return true;
+}
+
+void StateJournal::append(const uint8_t newStates) {
+  if (firstSector == 0 || newStates == states) {
+return;
+  }
+  if (next >= STATEJOURNAL_RECORDS) {
+    current ^= 1;
+    next = 0;
+    if (eraseOther) {
+      // service() didn't get to it
+      ESP.flashEraseSector(firstSector + current);
+      eraseOther = false;
+    }
+  }
+  Record record = {
+    .sequence = sequence,
+    .states = newStates,
+  };
+  record.crc = RemoteRelaySettings::crc8((const uint8_t *) &record, offsetof(Record, crc));
+  if (!ESP.flashWrite(address(current, next), (const uint32_t *) &record, sizeof(record))) {
+    LOG_INFO("{'stateJournal': 'write failed'}");
+  }
+  ++sequence;
+  states = newStates;
+  if (next++ == 0) {
+    // the other sector is superseded now
+    eraseOther = true;
+  }
+}
+
+void StateJournal::service() {
+  if (eraseOther) {
+    ESP.flashEraseSector(firstSector + (current ^ 1));
+    eraseOther = false;
+  }
+}
@@ -0,0 +1,68 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef STATEJOURNAL_H
+#define STATEJOURNAL_H
+
+#include <Arduino.h>
+#include "FlashReserve.h"
+
+#define STATEJOURNAL_RECORDS (FLASH_SECTOR_SIZE / sizeof(StateJournal::Record))
+
+/**
+ * Append-only journal of the channel states in two reserved flash sectors.
+ *
+ * Every change programs one 4 Byte record into erased flash, nothing else is rewritten.
+ * When the first record lands in a sector, the other one only holds older states and
+ * is erased by service(), so it's ready before the current one is full.
+ * begin() picks the sector with the newer first record and binary searches its last
+ * programmed record, a record torn by a power loss fails its crc and is skipped.
+ */
+class StateJournal {
+  public:
+    struct Record {
+      uint16_t sequence;
+      uint8_t states;       // channel 1 is bit 0, set if R_CLOSE
+      uint8_t crc;          // crc8 of the bytes before
+    };
+
+  private:
+    uint32_t firstSector;
+    uint8_t current;        // Sector being written, relative to firstSector
+    uint16_t next;          // Record index to be written next
+    uint16_t sequence;      // of the next record
+    uint8_t states;         // Last journaled states
+    bool eraseOther;
+
+  public:
+    StateJournal();
+    bool begin(uint8_t &restored);            // Find the latest record, false if there is none
+    void append(uint8_t states);              // Journal the states if they changed
+    void service();                           // Erase the superseded sector, call from loop()
+
+  private:
+    uint32_t address(uint8_t sector, uint16_t index) const;
+    bool readRecord(uint8_t sector, uint16_t index, Record &) const;  // false if erased or the crc doesn't match
+    bool isErased(uint8_t sector, uint16_t index) const;
+};
+
+extern StateJournal stateJournal;
+
+#endif  // STATEJOURNAL_H
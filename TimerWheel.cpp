@@ -0,0 +1,104 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "TimerWheel.h"
+#include "RelayQueue.h"
+
+TimerWheel::TimerWheel() {
+  memset(slots, TIMERWHEEL_NONE, sizeof(slots));
+  // chain all nodes into the free list
+  for (uint8_t i = TIMERWHEEL_NODES; i --> 0; ) {
+    nodes[i].next = (i + 1 < TIMERWHEEL_NODES) ? i + 1 : TIMERWHEEL_NONE;
+  }
+  freeList = 0;
+  used = 0;
+  lastTick = 0;
+}
+
+bool TimerWheel::schedule(const uint32_t delay, const uint8_t channel, const RSTM32Mode mode) {
+  if (freeList == TIMERWHEEL_NONE) {
+return false;
+  }
+  if (used == 0) {
+    // service() doesn't track time while idle
+    lastTick = millis();
+  }
+  const uint8_t n = freeList;
+  Node &node = nodes[n];
+  freeList = node.next;
+  ++used;
+
+  // after lastTick, slots up to it are done
+  node.expiry = millis() + max(delay, (uint32_t) 1);
+  node.channel = channel;
+  node.mode = mode;
+  uint8_t &slot = slots[node.expiry & (TIMERWHEEL_SLOTS - 1)];
+  node.next = slot;
+  slot = n;
+  return true;
+}
+
+void TimerWheel::release(uint8_t * const link) {
+  const uint8_t n = *link;
+  *link = nodes[n].next;
+  nodes[n].next = freeList;
+  freeList = n;
+  --used;
+}
+
+void TimerWheel::cancel(const uint8_t channel) {
+  for (uint16_t s = TIMERWHEEL_SLOTS; used > 0 && s --> 0; ) {
+    uint8_t *link = &slots[s];
+    while (*link != TIMERWHEEL_NONE) {
+      if (nodes[*link].channel == channel) {
+        release(link);
+      } else {
+        link = &nodes[*link].next;
+      }
+    }
+  }
+}
+
+void TimerWheel::service() {
+  const uint32_t now = millis();
+  if (used == 0) {
+return;
+  }
+  // every slot at most once, after that all expiries up to now are covered
+  const uint32_t ticks = min(now - lastTick, (uint32_t) TIMERWHEEL_SLOTS);
+  for (uint32_t t = 1; t <= ticks; ++t) {
+    uint8_t *link = &slots[(lastTick + t) & (TIMERWHEEL_SLOTS - 1)];
+    while (*link != TIMERWHEEL_NONE) {
+      const uint8_t n = *link;
+      Node &node = nodes[n];
+      if ((int32_t) (now - node.expiry) < 0) {
+        // a later round
+        link = &node.next;
+    continue;
+      }
+      // free before acting, the action may schedule again
+      const uint8_t channel = node.channel;
+      const RSTM32Mode mode = node.mode;
+      release(link);
+      relayQueue.request(channel, mode);
+    }
+  }
+  lastTick = now;
+}
@@ -0,0 +1,68 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "RemoteRelay.h"
+
+#define TIMERWHEEL_SLOTS 256          // 1 ms each, power of 2
+#define TIMERWHEEL_NODES 32           // Pending timers over all channels
+#define TIMERWHEEL_MAX_MS 604800000UL // 7 days, keeps expiry comparisons unambiguous
+#define TIMERWHEEL_NONE 0xFF
+
+/**
+ * Hashed timer wheel switching channels after a delay, e.g. the "off" of a pulse.
+ *
+ * A timer sits in the slot of its expiry modulo TIMERWHEEL_SLOTS. service() visits
+ * the slots of the milliseconds passed since its last call (all slots at most once)
+ * and fires what is due, so the cost per tick doesn't depend on the number of timers.
+ * Timers are taken from a fixed pool. cancel() walks all slots, it only runs on commands.
+ */
+class TimerWheel {
+  private:
+    struct Node {
+      uint32_t expiry;        // millis()
+      uint8_t next;           // Index in nodes, TIMERWHEEL_NONE at the end
+      uint8_t channel;
+      RSTM32Mode mode   :8;
+    };
+
+    Node nodes[TIMERWHEEL_NODES];
+    uint8_t slots[TIMERWHEEL_SLOTS];                  // Head of each slot's list
+    uint8_t freeList;
+    uint8_t used;
+    uint32_t lastTick;                                // Last millis() handled
+
+  public:
+    TimerWheel();
+    bool schedule(uint32_t delay, uint8_t channel, RSTM32Mode mode);  // false if the pool is exhausted
+    void cancel(uint8_t channel);                     // Forget all pending timers of a channel
+    void service();                                   // Fire due timers, call from loop()
+    uint8_t getPending() const { return used; }
+    bool isFull() const { return freeList == TIMERWHEEL_NONE; }
+
+  private:
+    void release(uint8_t *link);                      // Unlink the node link points to, back to the pool
+};
+
+extern TimerWheel timerWheel;
+
+#endif  // TIMERWHEEL_H
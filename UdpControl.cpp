@@ -0,0 +1,331 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "UdpControl.h"
+#include "RemoteRelay.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+#include "Groups.h"
+#include <bearssl/bearssl_hmac.h>
+
+#define UDPCONTROL_HEADER_LEN 8
+#define UDPCONTROL_COMMAND 0x01
+#define UDPCONTROL_GROUP 0x02
+#define UDPCONTROL_GROUP_ACKED 0x03
+#define UDPCONTROL_ACK 0x81
+#define UDPCONTROL_LEASE_RECORDS (FLASH_SECTOR_SIZE / sizeof(UdpControl::Lease))
+
+#define UDPCONTROL_SPACE_COMMANDS 0
+#define UDPCONTROL_SPACE_GROUPS 1
+
+static_assert(FLASH_PAGE_SIZE % sizeof(UdpControl::Lease) == 0, "flash is programmed in words, within pages");
+
+UdpControl::UdpControl() {
+  for (SeqSpace &space : spaces) {
+    space.high = 0;
+    space.leased = 0;
+    space.status = UDPCONTROL_STALE;
+  }
+  firstSector = 0;
+  current = 0;
+  next = 0;
+  eraseOther = false;
+  channelCount = 0;
+  started = false;
+  rejected = 0;
+  duplicates = 0;
+  stale = 0;
+}
+
+void UdpControl::begin(const uint8_t count) {
+  if (started) {
+return;
+  }
+  if (!loadLease()) {
+    // replays after a reboot couldn't be told apart
+    LOG_INFO("{'udpControl': 'no flash reserved'}");
+return;
+  }
+  channelCount = min(count, (uint8_t) RELAY_NUMBER_OF_CHANNELS);
+  udp.begin(UDP_CONTROL_PORT);
+  // bound to any address, gets the datagrams of all joined groups
+  multicast.begin(UDP_GROUP_PORT);
+  groups.joinAll();
+  started = true;
+}
+
+void UdpControl::sign(const uint8_t * const data, const size_t len, uint8_t * const tag) const {
+  char key[AUTHBASIC_LEN_USERNAME + 1 + AUTHBASIC_LEN_PASSWORD + 1];
+  const int keyLen = snprintf(key, sizeof(key), "%s:%s", settings.login, settings.password);
+  br_hmac_key_context kc;
+  br_hmac_key_init(&kc, &br_sha256_vtable, key, keyLen);
+  br_hmac_context ctx;
+  br_hmac_init(&ctx, &kc, UDPCONTROL_TAG_LEN);
+  br_hmac_update(&ctx, data, len);
+  br_hmac_out(&ctx, tag);
+}
+
+uint32_t UdpControl::leaseAddress(const uint8_t sector, const uint16_t index) const {
+  return (firstSector + sector) * FLASH_SECTOR_SIZE + index * sizeof(Lease);
+}
+
+bool UdpControl::loadLease() {
+  firstSector = flash_reserve_sector(FLASH_RESERVE_UDP_SEQ);
+  if (firstSector == 0) {
+return false;
+  }
+  // a few ms once, leases are rare enough that the sectors aren't searched smarter
+  bool found = false;
+  uint16_t used[FLASH_RESERVE_UDP_SEQ_SECTORS] = {0, 0};
+  for (uint8_t sector = FLASH_RESERVE_UDP_SEQ_SECTORS; sector --> 0; ) {
+    for (uint16_t i = 0; i < UDPCONTROL_LEASE_RECORDS; ++i) {
+      Lease lease;
+      ESP.flashRead(leaseAddress(sector, i), (uint32_t *) &lease, sizeof(lease));
+      if (lease.space == 0xFFFFFFFF && lease.seq == 0xFFFFFFFF && lease.check == 0xFFFFFFFF) {
+    break;
+      }
+      // torn records aren't reused either
+      used[sector] = i + 1;
+      if (lease.space < UDPCONTROL_SEQ_SPACES && lease.check == ~(lease.space ^ lease.seq)) {
+        found = true;
+        spaces[lease.space].leased = max(spaces[lease.space].leased, lease.seq);
+      }
+    }
+  }
+  if (!found) {
+    // blank or foreign content
+    if (used[0] != 0) {
+      ESP.flashEraseSector(firstSector);
+    }
+    current = 0;
+    next = 0;
+    eraseOther = used[1] != 0;
+return true;
+  }
+  for (SeqSpace &space : spaces) {
+    space.high = space.leased;
+  }
+  // Both sectors only have records if power was lost before the superseded one got erased.
+  // That one is full, a sector is only switched when it is.
+  current = (used[1] != 0 && (used[0] == 0 || used[0] == UDPCONTROL_LEASE_RECORDS)) ? 1 : 0;
+  next = used[current];
+  eraseOther = used[current ^ 1] != 0;
+  if (eraseOther) {
+    // the cut may have come between moving the leases of one kind and writing the other
+    for (uint8_t space = 0; space < UDPCONTROL_SEQ_SPACES; ++space) {
+      if (spaces[space].leased != 0) {
+        writeLease(space, spaces[space].leased);
+      }
+    }
+  }
+  return true;
+}
+
+void UdpControl::programLease(const uint8_t space, const uint32_t seq) {
+  const Lease lease = {
+    .space = space,
+    .seq = seq,
+    .check = ~(space ^ seq),
+    .unused = 0xFFFFFFFF,
+  };
+  if (!ESP.flashWrite(leaseAddress(current, next), (const uint32_t *) &lease, sizeof(lease))) {
+    LOG_INFO("{'udpControl': 'lease write failed'}");
+  }
+  if (next++ == 0) {
+    // the other sector is superseded now
+    eraseOther = true;
+  }
+}
+
+void UdpControl::writeLease(const uint8_t space, const uint32_t seq) {
+  if (next >= UDPCONTROL_LEASE_RECORDS) {
+    current ^= 1;
+    next = 0;
+    if (eraseOther) {
+      // service() didn't get to it
+      ESP.flashEraseSector(firstSector + current);
+      eraseOther = false;
+    }
+    // the superseded sector is erased soon, the leases of the other kind move along
+    for (uint8_t other = 0; other < UDPCONTROL_SEQ_SPACES; ++other) {
+      if (other != space && spaces[other].leased != 0) {
+        programLease(other, spaces[other].leased);
+      }
+    }
+  }
+  programLease(space, seq);
+  spaces[space].leased = seq;
+}
+
+uint8_t UdpControl::apply(const uint8_t * const ops, const uint8_t count) {
+  RSTM32Mode modes[RELAY_NUMBER_OF_CHANNELS];
+  uint8_t mask = 0;
+  // validate the whole batch before switching anything
+  for (uint8_t i = 0; i < count; ++i) {
+    const uint8_t channel = ops[i * 2];
+    const uint8_t mode = ops[i * 2 + 1];
+    if (mode == UDPCONTROL_MODE_QUERY) {
+  continue;
+    }
+    if (channel < 1 || channel > channelCount || mode > R_CLOSE) {
+return UDPCONTROL_INVALID;
+    }
+    modes[channel - 1] = (RSTM32Mode) mode;
+    mask |= 1 << (channel - 1);
+  }
+  if (mask == 0) {
+return UDPCONTROL_OK;
+  }
+  for (uint8_t channel = channelCount; channel > 0; --channel) {
+    if (mask & (1 << (channel - 1))) {
+      timerWheel.cancel(channel);
+    }
+  }
+  relayQueue.request(modes, mask);
+  return UDPCONTROL_OK;
+}
+
+uint8_t UdpControl::applyGroups(const uint32_t address, const uint8_t * const ops, const uint8_t count) {
+  RSTM32Mode modes[RELAY_NUMBER_OF_CHANNELS];
+  uint8_t mask = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    const uint8_t mode = ops[i * 2 + 1];
+    if (mode > R_CLOSE) {
+return UDPCONTROL_INVALID;
+    }
+    const uint8_t channels = groups.channels(address, ops[i * 2]) & ((1 << channelCount) - 1);
+    for (uint8_t channel = channelCount; channel > 0; --channel) {
+      if (channels & (1 << (channel - 1))) {
+        // later operations win
+        modes[channel - 1] = (RSTM32Mode) mode;
+      }
+    }
+    mask |= channels;
+  }
+  for (uint8_t channel = channelCount; channel > 0; --channel) {
+    if (mask & (1 << (channel - 1))) {
+      timerWheel.cancel(channel);
+    }
+  }
+  if (mask != 0) {
+    relayQueue.request(modes, mask);
+  }
+  return UDPCONTROL_OK;
+}
+
+void UdpControl::sendAck(WiFiUDP &from, const uint32_t seq, const uint8_t status, const uint32_t high) {
+  uint8_t ack[UDPCONTROL_HEADER_LEN + 6 + UDPCONTROL_TAG_LEN] = {
+    'R', 'U', UDPCONTROL_ACK, status,
+    (uint8_t) (seq >> 24), (uint8_t) (seq >> 16), (uint8_t) (seq >> 8), (uint8_t) seq,
+    channelBits(), channelCount,
+    (uint8_t) (high >> 24), (uint8_t) (high >> 16), (uint8_t) (high >> 8), (uint8_t) high,
+  };
+  sign(ack, UDPCONTROL_HEADER_LEN + 6, ack + UDPCONTROL_HEADER_LEN + 6);
+  from.beginPacket(from.remoteIP(), from.remotePort());
+  from.write(ack, sizeof(ack));
+  from.endPacket();
+}
+
+void UdpControl::receive(WiFiUDP &from) {
+  int len;
+  while ((len = from.parsePacket()) > 0) {
+    uint8_t packet[UDPCONTROL_HEADER_LEN + UDPCONTROL_MAX_OPS * 2 + UDPCONTROL_TAG_LEN];
+    if ((size_t) len > sizeof(packet) || from.read(packet, len) != len) {
+      ++rejected;
+  continue;
+    }
+    const uint8_t type = packet[2];
+    const uint8_t count = packet[3];
+    if (packet[0] != 'R' || packet[1] != 'U' || type < UDPCONTROL_COMMAND || type > UDPCONTROL_GROUP_ACKED
+        || len != UDPCONTROL_HEADER_LEN + count * 2 + UDPCONTROL_TAG_LEN) {
+      ++rejected;
+  continue;
+    }
+    uint8_t tag[UDPCONTROL_TAG_LEN];
+    sign(packet, len - UDPCONTROL_TAG_LEN, tag);
+    // constant time, don't tell how many bytes of the tag were right
+    uint8_t diff = 0;
+    for (uint8_t i = UDPCONTROL_TAG_LEN; i --> 0; ) {
+      diff |= tag[i] ^ packet[len - UDPCONTROL_TAG_LEN + i];
+    }
+    if (diff != 0) {
+      ++rejected;
+      LOG_DEBUG("{'udpControl': 'bad tag', 'from': '%s'}", from.remoteIP().toString().c_str());
+  continue;
+    }
+
+    const uint8_t * const ops = packet + UDPCONTROL_HEADER_LEN;
+    const uint32_t address = from.destinationIP();
+    if (type != UDPCONTROL_COMMAND) {
+      uint8_t member = 0;
+      for (uint8_t i = count; i --> 0; ) {
+        member |= groups.channels(address, ops[i * 2]);
+      }
+      if (member == 0) {
+        // meant for other boards
+  continue;
+      }
+    }
+    // no acks to group commands that didn't ask for one
+    const bool ack = type != UDPCONTROL_GROUP;
+
+    const uint8_t kind = (type == UDPCONTROL_COMMAND) ? UDPCONTROL_SPACE_COMMANDS : UDPCONTROL_SPACE_GROUPS;
+    SeqSpace &space = spaces[kind];
+    const uint32_t seq = (uint32_t) packet[4] << 24 | (uint32_t) packet[5] << 16 | (uint32_t) packet[6] << 8 | packet[7];
+    if (seq == space.high) {
+      // retry, ack again without switching
+      ++duplicates;
+      if (ack) {
+        sendAck(from, seq, space.status, space.high);
+      }
+  continue;
+    } else if (seq < space.high) {
+      // no wrap-around, an old datagram must never become new again
+      ++stale;
+      if (ack) {
+        sendAck(from, seq, UDPCONTROL_STALE, space.high);
+      } else {
+        LOG_DEBUG("{'udpControl': 'stale group command', 'seq': %u, 'high': %u}", (unsigned int) seq, (unsigned int) space.high);
+      }
+  continue;
+    }
+    if (seq > space.leased) {
+      // before switching, a reboot must not accept this seq again
+      writeLease(kind, seq + min((uint32_t) UDPCONTROL_SEQ_LEASE, UINT32_MAX - seq));
+    }
+    space.high = seq;
+    space.status = type == UDPCONTROL_COMMAND ? apply(ops, count) : applyGroups(address, ops, count);
+    if (ack) {
+      sendAck(from, seq, space.status, space.high);
+    }
+  }
+}
+
+void UdpControl::service() {
+  if (!started) {
+return;
+  }
+  receive(udp);
+  receive(multicast);
+  if (eraseOther) {
+    ESP.flashEraseSector(firstSector + (current ^ 1));
+    eraseOther = false;
+  }
+}
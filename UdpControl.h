@@ -0,0 +1,121 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef UDPCONTROL_H
+#define UDPCONTROL_H
+
+#include <WiFiUdp.h>
+#include "FlashReserve.h"
+
+#define UDP_CONTROL_PORT 8081
+#define UDP_GROUP_PORT 8082
+#define UDPCONTROL_SEQ_LEASE 256      // Sequence numbers accepted per flash write, see UdpControl
+#define UDPCONTROL_SEQ_SPACES 2       // Commands and group commands are numbered separately
+#define UDPCONTROL_MAX_OPS 8
+#define UDPCONTROL_TAG_LEN 16         // Truncated HMAC-SHA256
+
+/**
+ * Datagram layout, multi-byte fields big-endian:
+ *   'R' 'U' type count seq[4] {channel mode}[count] tag[16]
+ * type 0x01 is a command, its ack is type 0x81 with count replaced by the status:
+ *   'R' 'U' 0x81 status seq[4] states channel_count high[4] tag[16]
+ * states has bit 0 set if channel 1 is on. high is the newest seq the board accepted of that kind
+ * (commands or group commands), a sender whose command was stale continues after it. tag is the HMAC-SHA256 (keyed with
+ * "login:password") over everything before it.
+ *
+ * Group commands (type 0x02, or 0x03 to get an ack) are usually sent to a multicast address on
+ * UDP_GROUP_PORT and have group numbers in place of channels. Each board switches the channels
+ * it mapped to that address and group (see Groups.h), boards without such a mapping stay quiet.
+ * Their seq is separate from the one of commands, a controller talking to one board doesn't make
+ * the group commands of another one stale. A stale type 0x02 is dropped silently, controllers
+ * that don't keep their seq across restarts use type 0x03 to learn it.
+ */
+enum UdpControlStatus {
+  UDPCONTROL_OK        = 0,
+  UDPCONTROL_INVALID   = 1,   // An operation referred to an invalid channel or mode, nothing was switched
+  UDPCONTROL_STALE     = 2,   // seq is older than the newest one accepted, nothing was switched
+};
+
+#define UDPCONTROL_MODE_QUERY 2      // Operation that doesn't switch, just to get the states acked
+
+/**
+ * Authenticated UDP command port, to switch several channels without TCP setup.
+ *
+ * Senders are expected to increase seq with each new command and to repeat it unchanged
+ * on retries. A repeated seq is acked again without switching, so retries are idempotent.
+ * Only a seq above the newest one accepted switches, whatever address it comes from, so a
+ * captured datagram can't be replayed. There's one such high-water mark for commands and one
+ * for group commands. They survive reboots: each is leased UDPCONTROL_SEQ_LEASE ahead in two
+ * reserved flash sectors, one 16 Byte record per lease, programmed before the command is
+ * carried out. Like StateJournal the sector not written to is erased when the other one gets
+ * its first record, the newest lease of the other kind is copied over before. Without the
+ * sectors the port isn't opened.
+ */
+class UdpControl {
+  public:
+    struct Lease {
+      uint32_t space;       // 0 for commands, 1 for group commands
+      uint32_t seq;
+      uint32_t check;       // ~(space ^ seq), a torn write doesn't match
+      uint32_t unused;      // records must not cross a flash page
+    };
+
+  private:
+    struct SeqSpace {
+      uint32_t high;        // Newest seq accepted
+      uint32_t leased;      // Persisted bound of high
+      uint8_t status;       // of high, for retries
+    };
+
+    WiFiUDP udp;
+    WiFiUDP multicast;
+    SeqSpace spaces[UDPCONTROL_SEQ_SPACES];
+    uint32_t firstSector;
+    uint8_t current;          // Sector with the newest lease, relative to firstSector
+    uint16_t next;            // Record index to be written next
+    bool eraseOther;
+    uint8_t channelCount;
+    bool started;
+    uint16_t rejected;
+    uint16_t duplicates;
+    uint16_t stale;
+
+    void sign(const uint8_t *data, size_t len, uint8_t *tag) const;
+    uint32_t leaseAddress(uint8_t sector, uint16_t index) const;
+    bool loadLease();                     // Find the newest leases, false if there is no flash for them
+    void programLease(uint8_t space, uint32_t seq);
+    void writeLease(uint8_t space, uint32_t seq);
+    uint8_t apply(const uint8_t *ops, uint8_t count);
+    uint8_t applyGroups(uint32_t address, const uint8_t *ops, uint8_t count);
+    void sendAck(WiFiUDP &, uint32_t seq, uint8_t status, uint32_t high);
+    void receive(WiFiUDP &);
+
+  public:
+    UdpControl();
+    void begin(uint8_t channelCount);
+    void service();                       // Handle datagrams and erase a superseded lease sector, call from loop()
+    uint16_t getRejected() const { return rejected; }     // Malformed or bad tag
+    uint16_t getDuplicates() const { return duplicates; }
+    uint16_t getStale() const { return stale; }           // Older than the newest seq of their kind
+};
+
+extern UdpControl udpControl;
+
+#endif  // UDPCONTROL_H
@@ -0,0 +1,609 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#include "WebFrontEnd.h"
+#include "RemoteRelay.h"
+
+static const char CT_TEXT[] PROGMEM = "text/plain";
+
+static_assert(WEBFRONTEND_AUTH > 6 + AUTHBASIC_LEN_TOKEN, "Authorization header of the longest credentials");
+
+static int hexValue(const char c) {
+  if (c >= '0' && c <= '9') {
+return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Decodes "+" and "%XX" in place.
+ */
+static void urlDecode(char *s) {
+  char *out = s;
+  for (; *s != '\0'; ++s, ++out) {
+    if (*s == '+') {
+      *out = ' ';
+    } else if (*s == '%' && hexValue(s[1]) >= 0 && hexValue(s[2]) >= 0) {
+      *out = hexValue(s[1]) << 4 | hexValue(s[2]);
+      s += 2;
+    } else {
+      *out = *s;
+    }
+  }
+  *out = '\0';
+}
+
+static const char *reasonPhrase(const int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    case 507: return "Insufficient Storage";
+    default: return "";
+  }
+}
+
+WebConnection::WebConnection() {
+  state = FREE;
+}
+
+void WebConnection::open(const WiFiClient &client) {
+  tcp = client;
+  // headers and body are written separately, Nagle would hold back the body until the client's delayed ACK
+  tcp.setNoDelay(true);
+  tcp.setTimeout(WEBFRONTEND_WRITE_MS);
+  requests = 0;
+  headersLen = 0;
+  stalled = false;
+  state = REQUEST_LINE;
+  lineLen = 0;
+  lineOverflow = false;
+  since = millis();
+}
+
+void WebConnection::close() {
+  tcp.stop();
+  state = FREE;
+}
+
+bool WebConnection::isFree() const {
+  return state == FREE;
+}
+
+bool WebConnection::isIdle() const {
+  return state == REQUEST_LINE && lineLen == 0;
+}
+
+bool WebConnection::isReceiving() const {
+  return state != FREE && state != COMPLETE && !isIdle();
+}
+
+unsigned long WebConnection::getSince() const {
+  return since;
+}
+
+uint16_t WebConnection::getRequests() const {
+  return requests;
+}
+
+bool WebConnection::receive() {
+  while (state != COMPLETE && state != FREE && tcp.available() > 0) {
+    if (state == BODY) {
+      // a body that isn't a form is skipped through the line buffer, it's unused meanwhile
+      char * const dst = form ? data + dataLen : line;
+      const size_t room = form ? contentLength : min((size_t) contentLength, sizeof(line));
+      const int n = tcp.read((uint8_t *) dst, min((size_t) tcp.available(), room));
+      if (n <= 0) {
+    break;
+      }
+      if (form) {
+        dataLen += n;
+        data[dataLen] = '\0';
+      }
+      contentLength -= n;
+      if (contentLength == 0) {
+        state = COMPLETE;
+      }
+  continue;
+    }
+    const int c = tcp.read();
+    if (isIdle()) {
+      since = millis();
+    }
+    if (c != '\n') {
+      if (lineLen < sizeof(line) - 1) {
+        line[lineLen++] = c;
+      } else {
+        lineOverflow = true;
+      }
+  continue;
+    }
+    if (lineLen > 0 && line[lineLen - 1] == '\r') {
+      --lineLen;
+    }
+    line[lineLen] = '\0';
+    processLine();
+    lineLen = 0;
+    lineOverflow = false;
+  }
+  if (state == COMPLETE) {
+    ++requests;
+    parseArgs();
+return true;
+  }
+  return false;
+}
+
+void WebConnection::processLine() {
+  if (state == REQUEST_LINE) {
+    processRequestLine();
+  } else {
+    processHeader();
+  }
+}
+
+void WebConnection::processRequestLine() {
+  if (lineLen == 0) {
+    // empty lines before a request are allowed
+return;
+  }
+  // for the response to a malformed request
+  http11 = true;
+  if (lineOverflow) {
+    fail(414);
+return;
+  }
+  char *target = strchr(line, ' ');
+  char *version = target != nullptr ? strchr(target + 1, ' ') : nullptr;
+  if (version == nullptr || strncmp(version + 1, "HTTP/1.", 7) != 0) {
+    fail(400);
+return;
+  }
+  *target++ = '\0';
+  *version++ = '\0';
+  http11 = version[7] != '0';
+  responded = false;
+  static const struct {
+    const char *name;
+    HTTPMethod method;
+  } METHODS[] = {
+    {"GET", HTTP_GET},
+    {"PUT", HTTP_PUT},
+    {"POST", HTTP_POST},
+    {"DELETE", HTTP_DELETE},
+    {"HEAD", HTTP_HEAD},
+    {"OPTIONS", HTTP_OPTIONS},
+    {"PATCH", HTTP_PATCH},
+  };
+  // no route has HTTP_ANY, so the others are answered with 404
+  requestMethod = HTTP_ANY;
+  for (const auto &m : METHODS) {
+    if (strcmp(line, m.name) == 0) {
+      requestMethod = m.method;
+  break;
+    }
+  }
+  // path '\0' query, the body is appended to the query
+  char * const query = strchr(target, '?');
+  if (query != nullptr) {
+    *query = '\0';
+  }
+  const size_t pathLen = strlen(target);
+  const size_t queryLen = query != nullptr ? strlen(query + 1) : 0;
+  if (pathLen + 1 + queryLen + 1 > sizeof(data)) {
+    fail(414);
+return;
+  }
+  memcpy(data, target, pathLen + 1);
+  argsStart = pathLen + 1;
+  if (query != nullptr) {
+    memcpy(data + argsStart, query + 1, queryLen);
+  }
+  dataLen = argsStart + queryLen;
+  data[dataLen] = '\0';
+  closeRequested = !http11;
+  form = false;
+  contentLength = 0;
+  authorization[0] = '\0';
+  ifNoneMatch[0] = '\0';
+  accept[0] = '\0';
+  headersLen = 0;
+  state = HEADERS;
+}
+
+void WebConnection::processHeader() {
+  if (lineLen == 0) {
+    if (contentLength == 0) {
+      state = COMPLETE;
+return;
+    }
+    if (form) {
+      // '&' between query and body, the terminator
+      if ((size_t) dataLen + 1 + contentLength + 1 > sizeof(data)) {
+        fail(413);
+return;
+      }
+      if (dataLen > argsStart) {
+        data[dataLen++] = '&';
+      }
+    }
+    state = BODY;
+return;
+  }
+  if (lineOverflow) {
+    // none of those we care about is that long
+return;
+  }
+  char * const colon = strchr(line, ':');
+  if (colon == nullptr) {
+return;
+  }
+  *colon = '\0';
+  const char *value = colon + 1;
+  while (*value == ' ' || *value == '\t') {
+    ++value;
+  }
+  if (strcasecmp(line, "Content-Length") == 0) {
+    char *end;
+    const unsigned long len = strtoul(value, &end, 10);
+    if (*end != '\0' || len > UINT16_MAX) {
+      fail(413);
+return;
+    }
+    contentLength = len;
+  } else if (strcasecmp(line, "Content-Type") == 0) {
+    form = strncasecmp(value, "application/x-www-form-urlencoded", 33) == 0;
+  } else if (strcasecmp(line, "Connection") == 0) {
+    closeRequested = strcasecmp(value, "close") == 0 || (!http11 && strcasecmp(value, "keep-alive") != 0);
+  } else if (strcasecmp(line, "Authorization") == 0) {
+    // a longer one can't match anyway
+    if (strlen(value) < sizeof(authorization)) {
+      strcpy(authorization, value);
+    }
+  } else if (strcasecmp(line, "If-None-Match") == 0) {
+    strncpy(ifNoneMatch, value, sizeof(ifNoneMatch) - 1);
+    ifNoneMatch[sizeof(ifNoneMatch) - 1] = '\0';
+  } else if (strcasecmp(line, "Accept") == 0) {
+    strncpy(accept, value, sizeof(accept) - 1);
+    accept[sizeof(accept) - 1] = '\0';
+  }
+}
+
+void WebConnection::parseArgs() {
+  argCount = 0;
+  char *next = data + argsStart;
+  while (*next != '\0' && argCount < WEBFRONTEND_ARGS) {
+    char * const name = next;
+    char * const end = strchr(name, '&');
+    if (end != nullptr) {
+      *end = '\0';
+      next = end + 1;
+    } else {
+      next = name + strlen(name);
+    }
+    if (*name == '\0') {
+  continue;
+    }
+    char *value = strchr(name, '=');
+    if (value != nullptr) {
+      *value++ = '\0';
+      urlDecode(value);
+    } else {
+      value = name + strlen(name);
+    }
+    urlDecode(name);
+    argNames[argCount] = name;
+    argValues[argCount] = value;
+    ++argCount;
+  }
+}
+
+void WebConnection::fail(const int code) {
+  closeRequested = true;
+  char body[40];
+  const int len = snprintf(body, sizeof(body), "%d %s\r\n", code, reasonPhrase(code));
+  send(code, CT_TEXT, body, min((size_t) len, sizeof(body) - 1));
+  close();
+}
+
+bool WebConnection::keepAlive() const {
+  return !closeRequested && requests < HTTP_KEEPALIVE_MAX_REQUESTS;
+}
+
+void WebConnection::writeHead(const int code, PGM_P contentType, const long contentLength) {
+  char head[256];
+  int len = snprintf(head, sizeof(head), "HTTP/1.%c %d %s\r\nConnection: %s\r\n%.*s"
+    , http11 ? '1' : '0'
+    , code
+    , reasonPhrase(code)
+    , keepAlive() ? "keep-alive" : "close"
+    , (int) headersLen, headers
+  );
+  headersLen = 0;
+  if (code == 304) {
+    // no body, not even an empty one
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+  } else {
+    char type[48];
+    strncpy_P(type, contentType, sizeof(type) - 1);
+    type[sizeof(type) - 1] = '\0';
+    if (contentLength < 0) {
+      len += snprintf(head + len, sizeof(head) - len, "Content-Type: %s\r\n%s\r\n", type, chunked ? "Transfer-Encoding: chunked\r\n" : "");
+    } else {
+      len += snprintf(head + len, sizeof(head) - len, "Content-Type: %s\r\nContent-Length: %ld\r\n\r\n", type, contentLength);
+    }
+  }
+  write((const uint8_t *) head, min((size_t) len, sizeof(head) - 1));
+  responded = true;
+}
+
+/**
+ * Only the first write that doesn't complete within WEBFRONTEND_WRITE_MS waits, the following
+ * ones of the response are skipped. A stalled client holds up loop() once, not for every chunk.
+ */
+void WebConnection::write(const uint8_t * const bytes, const size_t len) {
+  if (stalled) {
+return;
+  }
+  if (tcp.write(bytes, len) != len) {
+    stalled = true;
+    LOG_DEBUG("{'webFrontEnd': 'client stalled'}");
+  }
+}
+
+void WebConnection::write_P(PGM_P bytes, const size_t len) {
+  if (stalled) {
+return;
+  }
+  if (tcp.write_P(bytes, len) != len) {
+    stalled = true;
+    LOG_DEBUG("{'webFrontEnd': 'client stalled'}");
+  }
+}
+
+void WebConnection::finish(const bool handled) {
+  if (!handled) {
+    send_P(404, CT_TEXT, PSTR("Not found\r\n"));
+  } else if (!responded) {
+    // taken over by the handler
+    tcp = WiFiClient();
+    state = FREE;
+return;
+  }
+  if (stalled || !keepAlive() || !tcp.connected()) {
+    close();
+return;
+  }
+  state = REQUEST_LINE;
+  since = millis();
+}
+
+HTTPMethod WebConnection::method() const {
+  return requestMethod;
+}
+
+const char *WebConnection::uri() const {
+  return data;
+}
+
+int WebConnection::args() const {
+  return argCount;
+}
+
+const char *WebConnection::argName(const int i) const {
+  return i >= 0 && i < argCount ? argNames[i] : "";
+}
+
+const char *WebConnection::arg(const int i) const {
+  return i >= 0 && i < argCount ? argValues[i] : "";
+}
+
+const char *WebConnection::arg(const char * const name) const {
+  for (uint8_t i = 0; i < argCount; ++i) {
+    if (strcmp(argNames[i], name) == 0) {
+return argValues[i];
+    }
+  }
+  return "";
+}
+
+bool WebConnection::hasArg(const char * const name) const {
+  for (uint8_t i = 0; i < argCount; ++i) {
+    if (strcmp(argNames[i], name) == 0) {
+return true;
+    }
+  }
+  return false;
+}
+
+const char *WebConnection::header(const char * const name) const {
+  if (strcasecmp(name, "Authorization") == 0) {
+return authorization;
+  }
+  if (strcasecmp(name, "If-None-Match") == 0) {
+return ifNoneMatch;
+  }
+  if (strcasecmp(name, "Accept") == 0) {
+return accept;
+  }
+  return "";
+}
+
+void WebConnection::requestAuthentication() {
+  sendHeader("WWW-Authenticate", "Basic realm=\"Login Required\"");
+  writeHead(401, CT_TEXT, 0);
+}
+
+void WebConnection::sendHeader(const char * const name, const char * const value) {
+  const int len = snprintf(headers + headersLen, sizeof(headers) - headersLen, "%s: %s\r\n", name, value);
+  if (len > 0 && (size_t) (headersLen + len) < sizeof(headers)) {
+    headersLen += len;
+  } else {
+    LOG_DEBUG("{'webFrontEnd': 'header dropped', 'name': '%s'}", name);
+  }
+}
+
+void WebConnection::send(const int code, const char * const contentType, const char * const content, const size_t len) {
+  writeHead(code, contentType, len);
+  write((const uint8_t *) content, len);
+}
+
+void WebConnection::send_P(const int code, PGM_P contentType, PGM_P content) {
+  const size_t len = strlen_P(content);
+  writeHead(code, contentType, len);
+  write_P(content, len);
+}
+
+void WebConnection::chunkedResponseModeStart(const int code, const char * const contentType) {
+  // HTTP/1.0 has no chunks, the body ends with the connection
+  chunked = http11;
+  if (!chunked) {
+    closeRequested = true;
+  }
+  writeHead(code, contentType, -1);
+}
+
+void WebConnection::sendContent(const char * const content, const size_t len) {
+  if (len == 0) {
+    // would end the response
+return;
+  }
+  if (!chunked) {
+    write((const uint8_t *) content, len);
+return;
+  }
+  char size[12];
+  const int n = snprintf(size, sizeof(size), "%x\r\n", (unsigned int) len);
+  write((const uint8_t *) size, n);
+  write((const uint8_t *) content, len);
+  write((const uint8_t *) "\r\n", 2);
+}
+
+void WebConnection::chunkedResponseFinalize() {
+  if (chunked) {
+    write((const uint8_t *) "0\r\n\r\n", 5);
+  }
+}
+
+WiFiClient &WebConnection::client() {
+  return tcp;
+}
+
+WebFrontEnd::WebFrontEnd(const uint16_t port) : server(port) {
+  dispatcher = nullptr;
+  keptAlive = 0;
+  evicted = 0;
+  started = false;
+}
+
+void WebFrontEnd::begin(const Dispatcher d) {
+  if (started) {
+return;
+  }
+  dispatcher = d;
+  server.begin();
+  server.setNoDelay(true);
+  started = true;
+}
+
+void WebFrontEnd::accept() {
+  if (!server.hasClient()) {
+return;
+  }
+  const unsigned long now = millis();
+  WebConnection *slot = nullptr;
+  WebConnection *oldestIdle = nullptr;
+  for (WebConnection &c : connections) {
+    if (c.isFree()) {
+      slot = &c;
+  break;
+    }
+    if (c.isIdle() && (oldestIdle == nullptr || now - c.getSince() > now - oldestIdle->getSince())) {
+      oldestIdle = &c;
+    }
+  }
+  if (slot == nullptr) {
+    if (oldestIdle == nullptr) {
+      // all busy with requests, the client waits in the backlog
+return;
+    }
+    oldestIdle->close();
+    ++evicted;
+    slot = oldestIdle;
+  }
+  slot->open(server.accept());
+}
+
+void WebFrontEnd::service() {
+  if (!started) {
+return;
+  }
+  accept();
+  const unsigned long now = millis();
+  for (WebConnection &c : connections) {
+    if (c.isFree()) {
+  continue;
+    }
+    if (c.receive()) {
+      if (c.getRequests() > 1) {
+        ++keptAlive;
+      }
+      c.finish(dispatcher(c));
+  continue;
+    }
+    if (c.isFree()) {
+      // failed while parsing
+  continue;
+    }
+    if (!c.client().connected()) {
+      c.close();
+  continue;
+    }
+    if (now - c.getSince() > (c.isReceiving() ? WEBFRONTEND_REQUEST_MS : HTTP_KEEPALIVE_IDLE_MS)) {
+      c.close();
+    }
+  }
+}
+
+bool WebFrontEnd::isStarted() const {
+  return started;
+}
+
+unsigned int WebFrontEnd::getKeptAlive() const {
+  return keptAlive;
+}
+
+unsigned int WebFrontEnd::getEvicted() const {
+  return evicted;
+}
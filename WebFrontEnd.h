@@ -0,0 +1,166 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef WEBFRONTEND_H
+#define WEBFRONTEND_H
+
+#include <ESP8266WiFi.h>
+#include "WebRequest.h"
+
+#define WEBFRONTEND_CONNECTIONS 4
+#define WEBFRONTEND_LINE 128          // Request line and header lines, longer headers are skipped
+#define WEBFRONTEND_DATA 256          // Request target and form body, args are decoded in place
+#define WEBFRONTEND_ARGS 8
+#define WEBFRONTEND_AUTH 64           // "Basic " and the base64 token of "login:password"
+#define WEBFRONTEND_ETAG 32           // If-None-Match
+#define WEBFRONTEND_ACCEPT 32         // Accept, truncated
+#define WEBFRONTEND_HEADERS 96        // Added by sendHeader() for the next response
+#define WEBFRONTEND_REQUEST_MS 3000   // To receive a request once its first byte arrived
+// A client not taking a write within that is dropped, the rest of the response skipped.
+// Writes block meanwhile, so each stalled client still holds up loop() once for up to that long.
+#define WEBFRONTEND_WRITE_MS 200
+
+/**
+ * One connection of the web front end, parsed incrementally as bytes arrive.
+ */
+class WebConnection : public WebRequest {
+  private:
+    enum State : uint8_t {
+      FREE,
+      REQUEST_LINE,   // also while kept alive between requests
+      HEADERS,
+      BODY,
+      COMPLETE,
+    };
+
+    WiFiClient tcp;
+    State state;
+    HTTPMethod requestMethod;
+    bool http11;
+    bool closeRequested;
+    bool form;
+    bool responded;
+    bool chunked;                 // else the body of chunkedResponseModeStart() ends with the connection
+    bool stalled;                 // a write fell short, finish() closes the connection
+    char line[WEBFRONTEND_LINE];
+    uint8_t lineLen;
+    bool lineOverflow;
+    char data[WEBFRONTEND_DATA];
+    uint16_t dataLen;
+    uint16_t argsStart;
+    uint16_t contentLength;
+    char authorization[WEBFRONTEND_AUTH];
+    char ifNoneMatch[WEBFRONTEND_ETAG];
+    char accept[WEBFRONTEND_ACCEPT];
+    char headers[WEBFRONTEND_HEADERS];
+    uint8_t headersLen;
+    uint8_t argCount;
+    const char *argNames[WEBFRONTEND_ARGS];
+    const char *argValues[WEBFRONTEND_ARGS];
+    uint16_t requests;
+    unsigned long since;          // start of the request being received, else of being idle
+
+    void processLine();
+    void processRequestLine();
+    void processHeader();
+    void parseArgs();
+    void fail(int code);
+    void writeHead(int code, PGM_P contentType, long contentLength);
+    void write(const uint8_t *bytes, size_t len);
+    void write_P(PGM_P bytes, size_t len);
+    bool keepAlive() const;
+
+  public:
+    WebConnection();
+    void open(const WiFiClient &client);
+    void close();
+    bool isFree() const;
+    bool isIdle() const;
+    bool isReceiving() const;
+    unsigned long getSince() const;
+    uint16_t getRequests() const;
+    /**
+     * Reads what has arrived, but not beyond the end of one request.
+     * @returns true if a request is complete
+     */
+    bool receive();
+    /**
+     * Ends the request after the dispatcher ran: responds with 404 if it wasn't handled,
+     * closes or keeps the connection alive.
+     */
+    void finish(bool handled);
+
+    HTTPMethod method() const override;
+    const char *uri() const override;
+    int args() const override;
+    const char *argName(int i) const override;
+    const char *arg(int i) const override;
+    const char *arg(const char *name) const override;
+    bool hasArg(const char *name) const override;
+    const char *header(const char *name) const override;
+    void requestAuthentication() override;
+    void sendHeader(const char *name, const char *value) override;
+    void send(int code, const char *contentType, const char *content, size_t len) override;
+    void send_P(int code, PGM_P contentType, PGM_P content) override;
+    void chunkedResponseModeStart(int code, const char *contentType) override;
+    void sendContent(const char *content, size_t len) override;
+    void chunkedResponseFinalize() override;
+    WiFiClient &client() override;
+};
+
+/**
+ * HTTP/1.1 server for the API, serving several connections side by side. Nothing blocks:
+ * service() reads what has arrived on each connection, a slow or stalled client only holds
+ * its own slot. Each complete request is handed to the dispatcher (the routes in WebHelper.cpp),
+ * at most one per connection and call, pipelined requests are answered in order. Responses are
+ * written right away, a client not taking them is dropped after one WEBFRONTEND_WRITE_MS wait.
+ *
+ * Connections are kept alive like those of the embedded server (HTTP_KEEPALIVE_IDLE_MS,
+ * HTTP_KEEPALIVE_MAX_REQUESTS). When all slots are taken, the longest idle one is closed
+ * for a new client, otherwise the new client waits in the accept backlog.
+ *
+ * Used while WiFiManager's portal doesn't run, that one owns port 80 then.
+ */
+class WebFrontEnd {
+  public:
+    typedef bool (*Dispatcher)(WebRequest &);
+
+  private:
+    WiFiServer server;
+    WebConnection connections[WEBFRONTEND_CONNECTIONS];
+    Dispatcher dispatcher;
+    unsigned int keptAlive;
+    unsigned int evicted;
+    bool started;
+
+    void accept();
+
+  public:
+    WebFrontEnd(uint16_t port);
+    void begin(Dispatcher dispatcher);
+    void service();                       // Accept, receive and dispatch, call from loop()
+    bool isStarted() const;
+    unsigned int getKeptAlive() const;    // Requests served on reused connections
+    unsigned int getEvicted() const;      // Idle connections closed for a new client
+};
+
+extern WebFrontEnd webFrontEnd;
+
+#endif  // WEBFRONTEND_H
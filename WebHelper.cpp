@@ -25,23 +25,81 @@
 #include <Arduino.h>
 
 #include "RemoteRelay.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+#include "Schedules.h"
+#include "Groups.h"
+#include "EventStream.h"
+#include "UdpControl.h"
+#include "MqttClient.h"
+#include "WebFrontEnd.h"
 #include "syntacticsugar.h"
 
-#include "divideandconquer_01.h"
+#include "PerfectHash.h"
+
+#ifdef UMM_STATS_FULL
+#include <umm_malloc/umm_malloc_cfg.h>
+#endif
 
 static const char CT_JSON[] = "application/json";
 static const char CT_TEXT[] = "text/plain";
+static const char CT_BINARY[] = "application/octet-stream";
+
+static uint8_t channelCount = 0;
+
+/**
+ * A rendered response body, rendered again only after the state generation changed.
+ */
+template<size_t SIZE>
+class CachedBody {
+  private:
+    char text[SIZE];
+    size_t len = 0;
+    uint32_t generation = 0;
+    bool valid = false;
+
+  public:
+    /**
+     * @param render like getJSONState(), writes the body to a buffer of SIZE
+     */
+    template<typename Render>
+    const char *get(const Render &render, size_t &outLen) {
+      const uint32_t current = getStateGeneration();
+      if (!valid || generation != current) {
+        len = min(render(text, SIZE), SIZE - 1);
+        generation = current;
+        valid = true;
+      }
+      outLen = len;
+      return text;
+    }
+};
+
+static CachedBody<32> channelBodies[RELAY_NUMBER_OF_CHANNELS];
+static CachedBody<128> settingsBody;
 
-// define enum stringlist https://stackoverflow.com/a/10966395
-#define FOREACH_FRUIT1(FRUIT)      \
-        FRUIT(debug)              \
-        FRUIT(login)              \
-        FRUIT(password)           \
-        FRUIT(serial)             \
-        FRUIT(ssid)               \
-        FRUIT(webservice)         \
-        FRUIT(wifimanager_portal) \
-        FRUIT(wpa_key)            \
+/**
+ * Tells ETags of previous boots apart, the generation starts at 0 again.
+ */
+static uint32_t bootId = 0;
+
+/**
+ * The connection WiFiManager's server currently serves, to tell whether it has been kept alive.
+ */
+static struct {
+  uint32_t ip;
+  uint16_t port;
+  uint16_t requests;
+  unsigned long lastRequest;
+} connection = {};
+static unsigned int keepAliveRequests = 0;
+
+#ifdef UMM_STATS_FULL
+/**
+ * Heap allocations during the last handler, including those of the web server while sending.
+ */
+static size_t lastRequestAllocations = 0;
+#endif
 
 #define GENERATE_ENUM(ENUM) WEB_PARAM_##ENUM,
 
@@ -52,21 +110,72 @@ enum ENUM_WEB_PARAM {
 #undef GENERATE_ENUM
 #define GENERATE_STRING(STRING) #STRING,
 
-// pucgenie: Is the overhead relevant?
-static const String WEB_PARAM[] = {
+static constexpr const char *WEB_PARAM[] = {
     FOREACH_FRUIT1(GENERATE_STRING)
 };
+static constexpr size_t WEB_PARAM_COUNT = sizeof(WEB_PARAM) / sizeof(WEB_PARAM[0]);
+static constexpr PerfectHash<WEB_PARAM_COUNT, 5> WEB_PARAM_HASH(WEB_PARAM);
 
 #undef GENERATE_STRING
-#undef FOREACH_FRUIT1
 
-bool isAuthBasicOK() {
+bool isAuthBasicOK(WebRequest &request) {
   // Disable auth if not credential provided
-  if (charnonempty(settings.login) && charnonempty(settings.password)
-      && !wifiManager.server->authenticate(settings.login, settings.password)) {
-    wifiManager.server->requestAuthentication();
+  if (!charnonempty(settings.login) || !charnonempty(settings.password)) {
+return true;
+  }
+  const char * const authorization = request.header("Authorization");
+  if (strncmp(authorization, "Basic ", 6) != 0 || !settings.isAuthToken(authorization + 6)) {
+    request.requestAuthentication();
+return false;
+  }
+  return true;
+}
+
+/**
+ * Called before each handler. Pipelined requests are read one after the other by the core,
+ * so they are answered in order.
+ */
+static void trackConnection() {
+  WiFiClient &client = wifiManager.server->client();
+  const uint32_t ip = client.remoteIP();
+  const uint16_t port = client.remotePort();
+  if (connection.requests != 0 && ip == connection.ip && port == connection.port) {
+    ++keepAliveRequests;
+  } else {
+    connection.ip = ip;
+    connection.port = port;
+    connection.requests = 0;
+    wifiManager.server->keepAlive(true);
+    // headers and body are written separately, Nagle would hold back the body until the client's delayed ACK
+    client.setNoDelay(true);
+  }
+  connection.lastRequest = millis();
+  if (++connection.requests >= HTTP_KEEPALIVE_MAX_REQUESTS) {
+    // "Connection: close" for this response, the client has to reconnect for the next request
+    wifiManager.server->keepAlive(false);
+  }
+}
+
+/**
+ * Adds the ETag of the current state generation to the response of a GET. If the
+ * request's If-None-Match has it already, sends an empty 304 instead.
+ * @returns true if the response has been sent
+ */
+static bool isNotModified(WebRequest &request) {
+  if (request.method() != HTTP_GET) {
+    // e.g. the settings after PUT /channel/:id
 return false;
   }
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%08x-%x\"", bootId, getStateGeneration());
+  request.sendHeader("Cache-Control", "no-cache");
+  request.sendHeader("ETag", etag);
+  const char * const ifNoneMatch = request.header("If-None-Match");
+  // may be a list, or weak
+  if (strstr(ifNoneMatch, etag) == nullptr && strcmp(ifNoneMatch, "*") != 0) {
+return false;
+  }
+  request.send(304, CT_JSON, "", 0);
   return true;
 }
 
@@ -78,30 +187,80 @@ return false;
 /**
  * GET /debug
  */
-void handleGETDebug() {
-  if (!isAuthBasicOK()) {
+void handleGETDebug(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
 return;
   }
-  String fromLog;
-  logger.getLog(fromLog);
-  wifiManager.server->send(200, CT_TEXT, fromLog);
-  // pucgenie: Note to myself: In C++ a stack object's destructor is called automatically.
-  //delete &fromLog;
+  // Chunked transfer encoding (close-delimited for HTTP/1.0), so the log never has to be held in memory as a whole.
+  request.chunkedResponseModeStart(200, CT_TEXT);
+  {
+    char stats[96];
+    int len = relayQueue.getStats(stats, sizeof(stats));
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+    len = snprintf(stats, sizeof(stats), "Event subscribers dropped: %u\r\n", eventStream.getDropped());
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+    len = snprintf(stats, sizeof(stats), "UDP datagrams rejected: %u, retries: %u, stale: %u\r\n", udpControl.getRejected(), udpControl.getDuplicates(), udpControl.getStale());
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+    len = snprintf(stats, sizeof(stats), "MQTT connected: %s\r\n", mqttClient.isConnected() ? "yes" : "no");
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+    len = snprintf(stats, sizeof(stats), "HTTP kept-alive requests: %u, idle connections evicted: %u\r\n"
+      , keepAliveRequests + webFrontEnd.getKeptAlive(), webFrontEnd.getEvicted());
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+    uint32_t heapFree;
+    uint16_t heapMaxBlock;
+    uint8_t heapFragmentation;
+    ESP.getHeapStats(&heapFree, &heapMaxBlock, &heapFragmentation);
+    len = snprintf(stats, sizeof(stats), "Heap largest block: %u, fragmentation: %u%%\r\n", heapMaxBlock, heapFragmentation);
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+#ifdef UMM_STATS_FULL
+    len = snprintf(stats, sizeof(stats), "Heap allocations by the previous request: %u\r\n", lastRequestAllocations);
+    request.sendContent(stats, min((size_t) len, sizeof(stats) - 1));
+#endif
+  }
+  logger.getLog([&request](const char *text, size_t len) {
+    request.sendContent(text, len);
+  });
+  request.chunkedResponseFinalize();
 }
 
 /**
- * GET /settings
+ * GET /log
+ * Args :
+ *   - since = <seq>   (optional, head of the previous response)
  */
-void handleGETSettings() {
-  if (!isAuthBasicOK()) {
+void handleGETLog(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
 return;
   }
-  // stack, no fragmentation
-  char buffer[BUF_SIZE];
-  if (settings.getJSONSettings(buffer, BUF_SIZE) > BUF_SIZE) {
-    // TODO: tell that something broke
+  uint32_t since = 0;
+  if (request.hasArg("since")) {
+    const char * const value = request.arg("since");
+    char *end;
+    since = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0') {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'since expected'}"));
+return;
+    }
+  }
+  request.chunkedResponseModeStart(200, CT_TEXT);
+  logger.getLogSince(since, [&request](const char *text, size_t len) {
+    request.sendContent(text, len);
+  });
+  request.chunkedResponseFinalize();
+}
+
+/**
+ * GET /settings
+ */
+void handleGETSettings(WebRequest &request) {
+  if (!isAuthBasicOK(request) || isNotModified(request)) {
+return;
   }
-  wifiManager.server->send(200, CT_JSON, String(buffer));
+  size_t len;
+  const char * const body = settingsBody.get([](char * const buffer, const size_t size) {
+    return settings.getJSONSettings(buffer, size);
+  }, len);
+  request.send(200, CT_JSON, body, len);
 }
 
 
@@ -112,102 +271,109 @@ return;
  *   - login = <str>
  *   - password = <str>
  */
-void handlePOSTSettings() {
-  if (!isAuthBasicOK()) {
+void handlePOSTSettings(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
 return;
   }
   // Check if args have been supplied
-  if (wifiManager.server->args() == 0) {
-    wifiManager.server->send(400, CT_TEXT, F("Invalid parameters\r\n"));
+  if (request.args() == 0) {
+    request.send_P(400, CT_TEXT, PSTR("Invalid parameters\r\n"));
 return;
   }
 
   // Parse args   
-  for (uint8_t i = wifiManager.server->args(); i --> 0; ) {
-    const String param = wifiManager.server->argName(i);
-    size_t idxOut;
-    if (!DivideAndConquer01::binarysearchString(idxOut, WEB_PARAM, param, sizeof(WEB_PARAM))) {
-      wifiManager.server->send(400, CT_TEXT, "Unknown parameter: " + param + "\r\n");
+  for (uint8_t i = request.args(); i --> 0; ) {
+    const char * const param = request.argName(i);
+    const size_t idxOut = WEB_PARAM_HASH.find(param, strlen(param));
+    if (idxOut == WEB_PARAM_COUNT) {
+      char msg[64];
+      const int len = snprintf(msg, sizeof(msg), "Unknown parameter: %s\r\n", param);
+      request.send(400, CT_TEXT, msg, min((size_t) len, sizeof(msg) - 1));
 return;
     }
     switch ((ENUM_WEB_PARAM) idxOut) {
       default: {
-        wifiManager.server->send(400, CT_TEXT, "Unimplemented parameter: " + param + "\r\n");
+        char msg[64];
+        const int len = snprintf(msg, sizeof(msg), "Unimplemented parameter: %s\r\n", param);
+        request.send(400, CT_TEXT, msg, min((size_t) len, sizeof(msg) - 1));
 return;
       }
       case WEB_PARAM_debug: { // debug
-        settings.flags.debug = wifiManager.server->arg(i).equalsIgnoreCase("true");
-        logger.info(F("{'updated_debug': %.5s}"), bool2str(settings.flags.debug));
+        settings.flags.debug = strcasecmp(request.arg(i), "true") == 0;
+        LOG_INFO("{'updated_debug': %.5s}", bool2str(settings.flags.debug));
       }
     break;
       case WEB_PARAM_login: { // login
-        wifiManager.server->arg(i).toCharArray(settings.login, AUTHBASIC_LEN_USERNAME);
-        logger.info(F("{'updated_login': '%s}"), settings.login);
+        strlcpy(settings.login, request.arg(i), AUTHBASIC_LEN_USERNAME);
+        LOG_INFO("{'updated_login': '%s}", settings.login);
+        settings.updateAuthToken();
       }
     break;
       case WEB_PARAM_password: { // password
-        wifiManager.server->arg(i).toCharArray(settings.password, AUTHBASIC_LEN_PASSWORD);
-        logger.info(F("{'updated_password': '%s'}"), settings.password);
+        strlcpy(settings.password, request.arg(i), AUTHBASIC_LEN_PASSWORD);
+        // the log is readable through GET /log, never put the password there
+        LOG_INFO("{'updated_password': true}");
+        settings.updateAuthToken();
       }
     break;
       case WEB_PARAM_serial: { // serial
-        settings.flags.serial = wifiManager.server->arg(i).equalsIgnoreCase("true");
+        settings.flags.serial = strcasecmp(request.arg(i), "true") == 0;
         logger.setSerial(settings.flags.serial);
-        logger.info(F("{'updated_serial': %.5s}"), bool2str(settings.flags.serial));
+        LOG_INFO("{'updated_serial': %.5s}", bool2str(settings.flags.serial));
       }
     break;
       case WEB_PARAM_wifimanager_portal: { // 
-        bool newSetting = wifiManager.server->arg(i).equalsIgnoreCase("true");
+        bool newSetting = strcasecmp(request.arg(i), "true") == 0;
         if (settings.flags.wifimanager_portal != newSetting) {
           // FIXME: stop or start it
         }
         settings.flags.wifimanager_portal = newSetting;
-        logger.info(F("{'updated_wifimanager_portal': %.5s}"), bool2str(settings.flags.wifimanager_portal));
+        LOG_INFO("{'updated_wifimanager_portal': %.5s}", bool2str(settings.flags.wifimanager_portal));
       }
     break;
       case WEB_PARAM_webservice: { // 
-        bool newSetting = wifiManager.server->arg(i).equalsIgnoreCase("true");
+        bool newSetting = strcasecmp(request.arg(i), "true") == 0;
         if (settings.flags.webservice != newSetting) {
           // FIXME: stop or start it
         }
         settings.flags.webservice = newSetting;
-        logger.info(F("{'updated_webservice': %.5s}"), bool2str(settings.flags.webservice));
+        LOG_INFO("{'updated_webservice': %.5s}", bool2str(settings.flags.webservice));
       }
     break;
       case WEB_PARAM_ssid: { // 
-        wifiManager.server->arg(i).toCharArray(settings.ssid, AUTHBASIC_LEN_PASSWORD);
-        logger.info(F("{'updated_serial': %.5s}"), bool2str(settings.flags.serial));
+        strlcpy(settings.ssid, request.arg(i), AUTHBASIC_LEN_PASSWORD);
+        LOG_INFO("{'updated_serial': %.5s}", bool2str(settings.flags.serial));
       }
     break;
       case WEB_PARAM_wpa_key: { // 
-        settings.flags.serial = wifiManager.server->arg(i).equalsIgnoreCase("true");
+        settings.flags.serial = strcasecmp(request.arg(i), "true") == 0;
         logger.setSerial(settings.flags.serial);
-        logger.info(F("{'updated_serial': %.5s}"), bool2str(settings.flags.serial));
+        LOG_INFO("{'updated_serial': %.5s}", bool2str(settings.flags.serial));
       }
     break;
     }
   }
 
   myLoopState = SAVE_SETTINGS;
+  // before saving, GET /settings would answer 304 meanwhile
+  bumpStateGeneration();
 
   // Reply with current settings
   // stack, no fragmentation
   char buffer[BUF_SIZE];
-  if (settings.getJSONSettings(buffer, BUF_SIZE) > BUF_SIZE) {
-    // TODO: tell that something broke
-  }
-  wifiManager.server->send(201, CT_JSON, String(buffer));
+  const size_t len = settings.getJSONSettings(buffer, BUF_SIZE);
+  request.send(201, CT_JSON, buffer, min(len, (size_t) BUF_SIZE - 1));
 }
 
 /**
  * POST /reset
  */
-void handlePOSTReset() {
-  if (!isAuthBasicOK()) {
+void handlePOSTReset(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
 return;
   }
   
-  logger.info(F("{'action': 'reset settings'}"));
+  LOG_INFO("{'action': 'reset settings'}");
 
   wifiManager.resetSettings();
   //setDefaultSettings(settings);
@@ -216,92 +382,727 @@ return;
   //saveSettings(settings);
   
   // Send response now
-  wifiManager.server->send(200, CT_TEXT, F("Reset OK"));
+  request.send_P(200, CT_TEXT, PSTR("Reset OK"));
 
   myLoopState = EEPROM_DESTROY_CRC;
 }
 
+/**
+ * Parses "<on|off>", responds with 400 if it's neither.
+ */
+static bool parseMode(WebRequest &request, const char * const value, RSTM32Mode &requestedMode) {
+  if (strcasecmp(value, "on") == 0) {
+    requestedMode = R_CLOSE;
+  } else if (strcasecmp(value, "off") == 0) {
+    requestedMode = R_OPEN;
+  } else {
+    char msg[64];
+    const int len = snprintf(msg, sizeof(msg), "{'invalid': %.16s, 'expected': ['on', 'off']}", value);
+    request.send(400, CT_JSON, msg, min((size_t) len, sizeof(msg) - 1));
+return false;
+  }
+  return true;
+}
+
 /**
  * PUT /channel/:id
  * Args :
  *   - mode = "<on|off>"
+ *   - duration = <ms>   (optional, switch back afterwards)
  */
-void handlePUTChannel(const uint8_t channel) {
+void handlePUTChannel(WebRequest &request, const uint8_t channel) {
   // TODO: pucgenie: Can't server handle this check itself?
-  if (!isAuthBasicOK()) {
+  if (!isAuthBasicOK(request)) {
 return;
   }
   
   // Check if args have been supplied
   // Check if requested arg has been suplied
-  if (wifiManager.server->args() != 1 || wifiManager.server->argName(0) != "mode") {
-    wifiManager.server->send(400, CT_JSON, F("{'invalidParameter': 'mode expected'}"));
+  const int argc = request.args();
+  if (!request.hasArg("mode") || argc > 2 || (argc == 2 && !request.hasArg("duration"))) {
+    request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'mode expected'}"));
 return;
   }
 
   {
     RSTM32Mode requestedMode;
-    const String value = wifiManager.server->arg(0);
-    if (value.equalsIgnoreCase("on")) {
-      requestedMode = R_CLOSE;
-    } else if (value.equalsIgnoreCase("off")) {
-      requestedMode = R_OPEN;
-    } else {
-      // pucgenie: Could have used a format string instead, but look how much pre-parsing and pre-compiling I did manually. xP
-      String msg;
-      /*static (... just put it on the stack using array-initializer) */ const char msgTail[] = ", 'expected': ['on', 'off']}";
-      const char msgHead[] = "{'invalid': ";
-      msg.reserve(sizeof(msgHead) + value.length() + sizeof(msgTail));
-      msg.concat(msgHead);
-      msg.concat(value);
-      msg.concat(msgTail);
-      wifiManager.server->send(400, CT_JSON, msg);
+    if (!parseMode(request, request.arg("mode"), requestedMode)) {
   return;
     }
+    unsigned long duration = 0;
+    if (argc == 2) {
+      const char * const value = request.arg("duration");
+      char *end;
+      duration = strtoul(value, &end, 10);
+      if (*value == '\0' || *end != '\0' || duration == 0 || duration > TIMERWHEEL_MAX_MS) {
+        request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'duration'}"));
+  return;
+      }
+      if (timerWheel.isFull()) {
+        request.send_P(503, CT_JSON, PSTR("{'error': 'too many timers'}"));
+  return;
+      }
+    }
 
     // Give some time to the watchdog
     ESP.wdtFeed();
     yield();
 
-    setChannel(channel, requestedMode);
+    // a new command replaces pending timers
+    timerWheel.cancel(channel);
+    relayQueue.request(channel, requestedMode);
+    if (duration != 0) {
+      timerWheel.schedule(duration, channel, (requestedMode == R_CLOSE) ? R_OPEN : R_CLOSE);
+    }
   }
   // stack, no fragmentation
-  handleGETSettings();
+  handleGETSettings(request);
 }
 
 /**
- * GET /channel/:id
+ * PUT /channels
+ * Args, either :
+ *   - mask = <bits>   (channel 1 is bit 0, decimal or 0x...)
+ *   - mode = "<on|off>"
+ * or per channel :
+ *   - <id> = "<on|off>"
+ * Everything is validated before the first relay is switched.
  */
-void handleGETChannel(const uint8_t channel) {
-  if (!isAuthBasicOK()) {
+void handlePUTChannels(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
 return;
   }
+
+  RSTM32Mode modes[RELAY_NUMBER_OF_CHANNELS];
+  uint8_t mask = 0;
+  if (request.hasArg("mask")) {
+    if (request.args() != 2 || !request.hasArg("mode")) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'mask and mode expected'}"));
+return;
+    }
+    const char * const value = request.arg("mask");
+    char *end;
+    const unsigned long requestedMask = strtoul(value, &end, 0);
+    if (*value == '\0' || *end != '\0' || requestedMask == 0 || requestedMask >= (1UL << channelCount)) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'mask'}"));
+return;
+    }
+    RSTM32Mode requestedMode;
+    if (!parseMode(request, request.arg("mode"), requestedMode)) {
+return;
+    }
+    mask = requestedMask;
+    for (uint8_t i = RELAY_NUMBER_OF_CHANNELS; i --> 0; ) {
+      modes[i] = requestedMode;
+    }
+  } else {
+    for (int i = request.args(); i --> 0; ) {
+      const char * const name = request.argName(i);
+      // single digit, RELAY_NUMBER_OF_CHANNELS is at most 8
+      const uint8_t channel = (name[0] != '\0' && name[1] == '\0') ? name[0] - '0' : 0;
+      if (channel < 1 || channel > channelCount || (mask & (1 << (channel - 1)))) {
+        request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'channel id expected'}"));
+return;
+      }
+      if (!parseMode(request, request.arg(i), modes[channel - 1])) {
+return;
+      }
+      mask |= 1 << (channel - 1);
+    }
+    if (mask == 0) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'mask or channel id expected'}"));
+return;
+    }
+  }
+
+  for (uint8_t channel = channelCount; channel > 0; --channel) {
+    if (mask & (1 << (channel - 1))) {
+      timerWheel.cancel(channel);
+    }
+  }
+  relayQueue.request(modes, mask);
+
   // stack, no fragmentation
   char buffer[BUF_SIZE];
-  getJSONState(channel, buffer, BUF_SIZE);
-  wifiManager.server->send(200, CT_JSON, String(buffer));
+  const size_t len = getJSONStates(buffer, BUF_SIZE);
+  request.send(200, CT_JSON, buffer, min(len, (size_t) BUF_SIZE - 1));
 }
 
-void setup_web_handlers(size_t channel_count) {
-  // pucgenie: Don't use F() for map keys.
+/**
+ * GET /channels
+ * JSON, or with "Accept: application/octet-stream" 10 bytes, multi-byte fields big-endian
+ * like UdpControl's datagrams:
+ *   generation[4] uptime_ms[4] channel_count states
+ * states has bit 0 set if channel 1 is on.
+ */
+void handleGETChannels(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  // read together, handlers run from loop() so nothing switches in between
+  const uint8_t states = channelBits();
+  const uint32_t generation = getStateGeneration();
+  const uint32_t uptime = millis();
+
+  request.sendHeader("Vary", "Accept");
+  if (strstr(request.header("Accept"), CT_BINARY) != nullptr) {
+    const uint8_t frame[] = {
+      (uint8_t) (generation >> 24), (uint8_t) (generation >> 16), (uint8_t) (generation >> 8), (uint8_t) generation,
+      (uint8_t) (uptime >> 24), (uint8_t) (uptime >> 16), (uint8_t) (uptime >> 8), (uint8_t) uptime,
+      channelCount,
+      states,
+    };
+    request.send(200, CT_BINARY, (const char *) frame, sizeof(frame));
+return;
+  }
+
+  // stack, no fragmentation
+  char buffer[BUF_SIZE];
+  size_t len = snprintf(buffer, BUF_SIZE, "{\"generation\":%u,\"uptime_ms\":%u,\"states\":%u,\"channels\":["
+    , generation
+    , uptime
+    , states
+  );
+  for (uint8_t channel = 1; channel <= channelCount && len < BUF_SIZE; ++channel) {
+    len += snprintf(buffer + len, BUF_SIZE - len, "%s{\"channel\":%u,\"mode\":\"%s\"}"
+      , (channel == 1) ? "" : ","
+      , channel
+      , (states & (1 << (channel - 1))) ? "on" : "off"
+    );
+  }
+  if (len < BUF_SIZE) {
+    len += snprintf(buffer + len, BUF_SIZE - len, "]}\n");
+  }
+  request.send(200, CT_JSON, buffer, min(len, (size_t) BUF_SIZE - 1));
+}
+
+/**
+ * GET /channel/:id
+ */
+void handleGETChannel(WebRequest &request, const uint8_t channel) {
+  if (!isAuthBasicOK(request) || isNotModified(request)) {
+return;
+  }
+  if (channel < 1 || channel > sizeof(channelBodies) / sizeof(channelBodies[0])) {
+    request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'channel'}"));
+return;
+  }
+  size_t len;
+  const char * const body = channelBodies[channel - 1].get([channel](char * const buffer, const size_t size) {
+    return getJSONState(channel, buffer, size);
+  }, len);
+  request.send(200, CT_JSON, body, len);
+}
+
+/**
+ * GET /events
+ * Server-Sent Events, one per state change, starting with the current states.
+ */
+void handleGETEvents(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  WiFiClient &client = request.client();
+  if (!eventStream.subscribe(client)) {
+    request.send_P(503, CT_JSON, PSTR("{'error': 'too many subscribers'}"));
+return;
+  }
+  char event[64];
+  for (uint8_t channel = 1; channel <= channelCount; ++channel) {
+    const size_t len = getEventState(channel, event, sizeof(event));
+    if (!eventStream.send(client, event, len)) {
+  break;
+    }
+  }
+}
+
+/**
+ * Streams the schedule table, up to SCHEDULES_MAX entries. Can't fail once started (HTTP/1.0
+ * clients get it close-delimited), so POST and DELETE answer with it after changing the table.
+ */
+static void sendSchedules(WebRequest &request) {
+  request.chunkedResponseModeStart(200, CT_JSON);
+  char buffer[96];
+  {
+    const time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    const size_t len = strftime(buffer, sizeof(buffer), R"=="==({"now":"%Y-%m-%d %H:%M:%S","schedules":[)=="==", &local);
+    request.sendContent(buffer, len);
+  }
+  for (uint8_t i = 0; i < schedules.getCount(); ++i) {
+    const ScheduleEntry &entry = schedules.get(i);
+    const int len = snprintf(buffer, sizeof(buffer), R"=="==(%s{"id":%u,"days":%u,"time":"%02u:%02u","channel":%u,"mode":"%.3s"})=="=="
+      , (i == 0) ? "" : ","
+      , i
+      , entry.weekdays
+      , entry.hour
+      , entry.minute
+      , entry.channel
+      , (entry.mode == R_CLOSE) ? "on" : "off"
+    );
+    request.sendContent(buffer, len);
+  }
+  const char TAIL[] = "]}\n";
+  request.sendContent(TAIL, sizeof(TAIL) - 1);
+  request.chunkedResponseFinalize();
+}
+
+/**
+ * GET /schedules
+ */
+void handleGETSchedules(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  sendSchedules(request);
+}
+
+/**
+ * POST /schedules
+ * Args :
+ *   - days = <bits>     (bit 0 is Sunday)
+ *   - time = "HH:MM"    (local time)
+ *   - channel = <id>
+ *   - mode = "<on|off>"
+ */
+void handlePOSTSchedules(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  if (request.args() != 4 || !request.hasArg("days") || !request.hasArg("time")
+      || !request.hasArg("channel") || !request.hasArg("mode")) {
+    request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'days, time, channel and mode expected'}"));
+return;
+  }
+  ScheduleEntry entry;
+  {
+    const char * const value = request.arg("days");
+    char *end;
+    const unsigned long days = strtoul(value, &end, 0);
+    if (*value == '\0' || *end != '\0' || days == 0 || days > 0x7F) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'days'}"));
+return;
+    }
+    entry.weekdays = days;
+  }
+  {
+    const char * const value = request.arg("time");
+    if (strlen(value) != 5 || !isdigit(value[0]) || !isdigit(value[1]) || value[2] != ':' || !isdigit(value[3]) || !isdigit(value[4])
+        || (entry.hour = (value[0] - '0') * 10 + (value[1] - '0')) > 23 || (entry.minute = (value[3] - '0') * 10 + (value[4] - '0')) > 59) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'time'}"));
+return;
+    }
+  }
+  {
+    const char * const value = request.arg("channel");
+    const uint8_t channel = (value[0] != '\0' && value[1] == '\0') ? value[0] - '0' : 0;
+    if (channel < 1 || channel > channelCount) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'channel'}"));
+return;
+    }
+    entry.channel = channel;
+  }
+  {
+    RSTM32Mode requestedMode;
+    if (!parseMode(request, request.arg("mode"), requestedMode)) {
+return;
+    }
+    entry.mode = requestedMode;
+  }
+  if (!schedules.add(entry)) {
+    request.send_P(507, CT_JSON, PSTR("{'error': 'schedule table full or no flash reserved'}"));
+return;
+  }
+  sendSchedules(request);
+}
+
+/**
+ * DELETE /schedules
+ * Args :
+ *   - id = <id>
+ */
+void handleDELETESchedules(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  const char * const value = request.arg("id");
+  char *end;
+  const unsigned long id = strtoul(value, &end, 10);
+  if (request.args() != 1 || *value == '\0' || *end != '\0' || id > UINT8_MAX || !schedules.remove(id)) {
+    request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'id'}"));
+return;
+  }
+  sendSchedules(request);
+}
+
+/**
+ * Streams the group table, up to GROUPS_MAX entries. Like sendSchedules() it can't fail once
+ * started, POST and DELETE answer with it after saving.
+ */
+static void sendGroups(WebRequest &request) {
+  request.chunkedResponseModeStart(200, CT_JSON);
+  char buffer[96];
+  {
+    const char HEAD[] = R"=="==({"groups":[)=="==";
+    request.sendContent(HEAD, sizeof(HEAD) - 1);
+  }
+  for (uint8_t i = 0; i < groups.getCount(); ++i) {
+    const GroupEntry &entry = groups.get(i);
+    const IPAddress address(entry.address);
+    const int len = snprintf(buffer, sizeof(buffer), R"=="==(%s{"id":%u,"address":"%u.%u.%u.%u","group":%u,"channels":%u})=="=="
+      , (i == 0) ? "" : ","
+      , i
+      , address[0], address[1], address[2], address[3]
+      , entry.group
+      , entry.channels
+    );
+    request.sendContent(buffer, len);
+  }
+  const char TAIL[] = "]}\n";
+  request.sendContent(TAIL, sizeof(TAIL) - 1);
+  request.chunkedResponseFinalize();
+}
+
+/**
+ * GET /groups
+ */
+void handleGETGroups(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  sendGroups(request);
+}
 
+/**
+ * POST /groups
+ * Args :
+ *   - address = <IPv4 multicast address>
+ *   - group = <0..255>
+ *   - channels = <bits>  (bit 0 is channel 1)
+ */
+void handlePOSTGroups(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  if (request.args() != 3 || !request.hasArg("address") || !request.hasArg("group")
+      || !request.hasArg("channels")) {
+    request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'address, group and channels expected'}"));
+return;
+  }
+  GroupEntry entry;
+  entry.reserved = 0;
+  {
+    IPAddress address;
+    if (!address.fromString(request.arg("address")) || !address.isV4() || address[0] < 224 || address[0] > 239) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'address'}"));
+return;
+    }
+    entry.address = address;
+  }
+  {
+    const char * const value = request.arg("group");
+    char *end;
+    const unsigned long group = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || group > UINT8_MAX) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'group'}"));
+return;
+    }
+    entry.group = group;
+  }
+  {
+    const char * const value = request.arg("channels");
+    char *end;
+    const unsigned long channels = strtoul(value, &end, 0);
+    if (*value == '\0' || *end != '\0' || channels == 0 || channels >= (1UL << channelCount)) {
+      request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'channels'}"));
+return;
+    }
+    entry.channels = channels;
+  }
+  if (!groups.add(entry)) {
+    request.send_P(507, CT_JSON, PSTR("{'error': 'group table full or no flash reserved'}"));
+return;
+  }
+  sendGroups(request);
+}
+
+/**
+ * DELETE /groups
+ * Args :
+ *   - id = <id>
+ */
+void handleDELETEGroups(WebRequest &request) {
+  if (!isAuthBasicOK(request)) {
+return;
+  }
+  const char * const value = request.arg("id");
+  char *end;
+  const unsigned long id = strtoul(value, &end, 10);
+  if (request.args() != 1 || *value == '\0' || *end != '\0' || id > UINT8_MAX || !groups.remove(id)) {
+    request.send_P(400, CT_JSON, PSTR("{'invalidParameter': 'id'}"));
+return;
+  }
+  sendGroups(request);
+}
+
+/**
+ * WebRequest on WiFiManager's server, while its portal owns port 80.
+ */
+class ServerWebRequest : public WebRequest {
+  private:
+    ESP8266WebServer &server;
+    bool responded = false;
+    bool closeDelimited = false;
+
+  public:
+    ServerWebRequest(ESP8266WebServer &server) : server(server) {}
+
+    /**
+     * @returns false if the handler took over client(), see WebRequest
+     */
+    bool hasResponded() const {
+      return responded;
+    }
+
+    HTTPMethod method() const override {
+      return server.method();
+    }
+
+    const char *uri() const override {
+      return server.uri().c_str();
+    }
+
+    int args() const override {
+      return server.args();
+    }
+
+    const char *argName(const int i) const override {
+      return server.argName(i).c_str();
+    }
+
+    const char *arg(const int i) const override {
+      return server.arg(i).c_str();
+    }
+
+    const char *arg(const char * const name) const override {
+      return server.arg(name).c_str();
+    }
+
+    bool hasArg(const char * const name) const override {
+      return server.hasArg(name);
+    }
+
+    const char *header(const char * const name) const override {
+      // header(String) would copy name to the heap
+      for (int i = 0; i < server.headers(); ++i) {
+        if (strcasecmp(server.headerName(i).c_str(), name) == 0) {
+return server.header(i).c_str();
+        }
+      }
+      return "";
+    }
+
+    void requestAuthentication() override {
+      responded = true;
+      server.requestAuthentication();
+    }
+
+    void sendHeader(const char * const name, const char * const value) override {
+      server.sendHeader(name, value);
+    }
+
+    void send(const int code, const char * const contentType, const char * const content, const size_t len) override {
+      responded = true;
+      server.send(code, contentType, content, len);
+    }
+
+    void send_P(const int code, PGM_P contentType, PGM_P content) override {
+      responded = true;
+      server.send_P(code, contentType, content);
+    }
+
+    void chunkedResponseModeStart(const int code, const char * const contentType) override {
+      responded = true;
+      if (server.chunkedResponseModeStart(code, contentType)) {
+return;
+      }
+      // HTTP/1.0, no Content-Length and "Connection: close", the body ends with the connection
+      closeDelimited = true;
+      server.keepAlive(false);
+      server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server.send(code, contentType, emptyString);
+    }
+
+    void sendContent(const char * const content, const size_t len) override {
+      server.sendContent(content, len);
+    }
+
+    void chunkedResponseFinalize() override {
+      if (closeDelimited) {
+        // the client waits for the end of the body, not the core's close timeout
+        server.client().stop();
+return;
+      }
+      server.chunkedResponseFinalize();
+    }
+
+    WiFiClient &client() override {
+      return server.client();
+    }
+};
+
+struct Route {
+  const char *path;
+  HTTPMethod method;
+  void (*handler)(WebRequest &request);
+};
+
+static const Route ROUTES[] = {
+  {"/debug", HTTP_GET, handleGETDebug},
+  {"/log", HTTP_GET, handleGETLog},
+  {"/settings", HTTP_GET, handleGETSettings},
+  {"/settings", HTTP_POST, handlePOSTSettings},
+  {"/schedules", HTTP_GET, handleGETSchedules},
+  {"/schedules", HTTP_POST, handlePOSTSchedules},
+  {"/schedules", HTTP_DELETE, handleDELETESchedules},
+  {"/groups", HTTP_GET, handleGETGroups},
+  {"/groups", HTTP_POST, handlePOSTGroups},
+  {"/groups", HTTP_DELETE, handleDELETEGroups},
+  {"/reset", HTTP_POST, handlePOSTReset},
+  {"/channels", HTTP_GET, handleGETChannels},
+  {"/channels", HTTP_PUT, handlePUTChannels},
+  {"/events", HTTP_GET, handleGETEvents},
+};
+
+/**
+ * One route for all /channel/<id>. The id is parsed from the URI instead of checking a
+ * path per channel.
+ */
+struct ChannelRoute {
+  HTTPMethod method;
+  void (*handler)(WebRequest &request, uint8_t channel);
+};
+
+static const ChannelRoute CHANNEL_ROUTES[] = {
+  {HTTP_GET, handleGETChannel},
+  {HTTP_PUT, handlePUTChannel},
+};
+
+/**
+ * @returns channel of "/channel/<id>", 0 if uri isn't one or the id is out of range
+ */
+static uint8_t parseChannel(const char * const uri) {
+  static const char PREFIX[] = "/channel/";
+  const size_t len = strlen(uri);
+  if (len < sizeof(PREFIX) || len > sizeof(PREFIX) + 2 || memcmp(uri, PREFIX, sizeof(PREFIX) - 1) != 0) {
+return 0;
+  }
+  unsigned int channel = 0;
+  for (size_t i = sizeof(PREFIX) - 1; i < len; ++i) {
+    if (!isdigit(uri[i])) {
+return 0;
+    }
+    channel = channel * 10 + (uri[i] - '0');
+  }
+  // the handlers index arrays of RELAY_NUMBER_OF_CHANNELS, don't rely on channelCount alone
+  return (channel <= channelCount && channel <= RELAY_NUMBER_OF_CHANNELS) ? channel : 0;
+}
+
+/**
+ * Looks up the route of method and uri, runs it unless request is nullptr.
+ * @returns false if there's none
+ */
+static bool runRoute(const HTTPMethod method, const char * const uri, WebRequest * const request) {
+  for (const Route &route : ROUTES) {
+    if (route.method == method && strcmp(route.path, uri) == 0) {
+      if (request != nullptr) {
+        route.handler(*request);
+      }
+return true;
+    }
+  }
+  const uint8_t channel = parseChannel(uri);
+  if (channel == 0) {
+return false;
+  }
+  for (const ChannelRoute &route : CHANNEL_ROUTES) {
+    if (route.method == method) {
+      if (request != nullptr) {
+        route.handler(*request, channel);
+      }
+return true;
+    }
+  }
+  return false;
+}
+
+bool dispatch_web_request(WebRequest &request) {
+#ifdef UMM_STATS_FULL
+  const size_t before = umm_get_malloc_count();
+#endif
+  const bool found = runRoute(request.method(), request.uri(), &request);
+#ifdef UMM_STATS_FULL
+  if (found) {
+    lastRequestAllocations = umm_get_malloc_count() - before;
+  }
+#endif
+  return found;
+}
+
+/**
+ * The API on WiFiManager's server, in front of the portal's own pages.
+ */
+class ServerRequestHandler : public RequestHandler {
+  public:
+    bool canHandle(const HTTPMethod method, const String &uri) override {
+      return runRoute(method, uri.c_str(), nullptr);
+    }
+
+    bool handle(ESP8266WebServer &server, const HTTPMethod method, const String &uri) override {
+      (void) method;
+      (void) uri;
+      trackConnection();
+      ServerWebRequest request(server);
+      const bool handled = dispatch_web_request(request);
+      if (!request.hasResponded()) {
+        // taken over (GET /events), service_web_keepalive() must not close it as idle
+        connection.requests = 0;
+      }
+      return handled;
+    }
+};
+
+void service_web_keepalive() {
+  if (!wifiManager.server) {
+return;
+  }
+  WiFiClient &client = wifiManager.server->client();
+  // A request in progress is left to the core's own timeouts. The copies of WiFiClient share
+  // the connection, so one a handler took over is forgotten in ServerRequestHandler::handle().
+  if (connection.requests == 0 || !client.connected() || client.available() > 0
+      || millis() - connection.lastRequest < HTTP_KEEPALIVE_IDLE_MS
+      || (uint32_t) client.remoteIP() != connection.ip || client.remotePort() != connection.port) {
+return;
+  }
+  client.stop();
+  connection.requests = 0;
+}
+
+void setup_web_handlers(size_t channel_count) {
+  // bounds the channel ids of all handlers, the per-channel arrays have RELAY_NUMBER_OF_CHANNELS entries
+  channelCount = min(channel_count, (size_t) RELAY_NUMBER_OF_CHANNELS);
+  if (bootId == 0) {
+    bootId = ESP.random();
+  }
+  if (!wifiManager.server) {
+    // served by webFrontEnd
+return;
+  }
+  wifiManager.server->keepAlive(true);
+  static const char *COLLECTED_HEADERS[] = {"If-None-Match", "Accept"};
+  wifiManager.server->collectHeaders(COLLECTED_HEADERS, sizeof(COLLECTED_HEADERS) / sizeof(COLLECTED_HEADERS[0]));
   // keep default portal
-  //wifiManager.server->on("/", handleGETRoot );
-  
-  wifiManager.server->on("/debug", HTTP_GET, handleGETDebug);
-  wifiManager.server->on("/settings", HTTP_GET, handleGETSettings);
-  wifiManager.server->on("/settings", HTTP_POST, handlePOSTSettings);
-  wifiManager.server->on("/reset", HTTP_POST, handlePOSTReset);
-  char _channelPath[] = "/channel/#";
-  do {
-    _channelPath[sizeof(_channelPath) / sizeof(_channelPath[0]) - 2] = '0' + channel_count;
-    // TODO: Check if the library copies the string
-    wifiManager.server->on(_channelPath, HTTP_PUT, std::bind(&handlePUTChannel, channel_count));
-    wifiManager.server->on(_channelPath, HTTP_GET, std::bind(&handleGETChannel, channel_count));
-  } while (channel_count-- != 0);
-  /* wifiManager can do better.
-  wifiManager.server->onNotFound([]() {
-    wifiManager.server->send(404, CT_TEXT, F("Not found\r\n"));
-  });
-  */
+  // on the heap, the server deletes its handlers when WiFiManager replaces it
+  wifiManager.server->addHandler(new ServerRequestHandler());
 }
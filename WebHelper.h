@@ -23,8 +23,33 @@
 #define WEBHELPER_H
 
 #include "RemoteRelay.h"
+#include "WebRequest.h"
 
-bool isAuthBasicOK();
+// define enum stringlist https://stackoverflow.com/a/10966395
+// The parameters of POST /settings
+#define FOREACH_FRUIT1(FRUIT)      \
+        FRUIT(debug)              \
+        FRUIT(login)              \
+        FRUIT(password)           \
+        FRUIT(serial)             \
+        FRUIT(ssid)               \
+        FRUIT(webservice)         \
+        FRUIT(wifimanager_portal) \
+        FRUIT(wpa_key)            \
+
+bool isAuthBasicOK(WebRequest &request);
+/**
+ * Adds the API to WiFiManager's server if its portal runs, webFrontEnd serves it otherwise.
+ */
 void setup_web_handlers(size_t channel_count);
+/**
+ * Runs the handler of the request's route, see WebFrontEnd::Dispatcher.
+ * @returns false if there's none
+ */
+bool dispatch_web_request(WebRequest &request);
+/**
+ * Closes the kept-alive connection of the web server after HTTP_KEEPALIVE_IDLE_MS without a request.
+ */
+void service_web_keepalive();
 
 #endif  // WEBHELPER_H
@@ -0,0 +1,69 @@
+/*************************************************************************
+ *
+ * This file is part of the Remoterelay Arduino sketch.
+ * Copyleft 2024 Johannes Unger (just minor enhancements)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * ***********************************************************************/
+
+#ifndef WEBREQUEST_H
+#define WEBREQUEST_H
+
+#include <ESP8266WebServer.h>
+
+/**
+ * The current request of a web server front end, as seen by the route handlers in WebHelper.cpp.
+ * The methods are named after ESP8266WebServer's. Args and URI are plain C strings that stay
+ * valid until the response has been sent, "" if missing.
+ *
+ * A handler that takes over client() (see GET /events) doesn't send a response, the front end
+ * then forgets the connection without closing it.
+ */
+class WebRequest {
+  public:
+    virtual ~WebRequest() {}
+
+    virtual HTTPMethod method() const = 0;
+    virtual const char *uri() const = 0;
+    virtual int args() const = 0;
+    virtual const char *argName(int i) const = 0;
+    virtual const char *arg(int i) const = 0;
+    virtual const char *arg(const char *name) const = 0;
+    virtual bool hasArg(const char *name) const = 0;
+    /**
+     * Only headers collected by the front end, that's Authorization, If-None-Match and Accept.
+     */
+    virtual const char *header(const char *name) const = 0;
+
+    virtual void requestAuthentication() = 0;
+
+    /**
+     * Adds a header to the next response.
+     */
+    virtual void sendHeader(const char *name, const char *value) = 0;
+    virtual void send(int code, const char *contentType, const char *content, size_t len) = 0;
+    virtual void send_P(int code, PGM_P contentType, PGM_P content) = 0;
+    /**
+     * Starts a response of unknown length, sent with sendContent(). HTTP/1.0 clients get the
+     * body unframed and the connection is closed after chunkedResponseFinalize().
+     */
+    virtual void chunkedResponseModeStart(int code, const char *contentType) = 0;
+    virtual void sendContent(const char *content, size_t len) = 0;
+    virtual void chunkedResponseFinalize() = 0;
+
+    virtual WiFiClient &client() = 0;
+};
+
+#endif  // WEBREQUEST_H
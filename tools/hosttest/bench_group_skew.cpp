@@ -0,0 +1,287 @@
+/**
+ * Multi-instance simulation of a group command: 12 boards, each a forked process with its own
+ * UdpControl, Groups, RelayQueue and TimerWheel, run their loop on the real clock. The same
+ * datagram is handed to all of them at once (standing in for the multicast) and each reports
+ * when its frames leave setChannels(). Measures the skew between the members, and checks that
+ * every member switches exactly once per command, that other boards stay quiet and that a
+ * replayed datagram switches nothing. Run it on an idle host, the numbers are only as good as
+ * its wake-up latency.
+ */
+// units: UdpControl.cpp Groups.cpp RelayQueue.cpp TimerWheel.cpp Logger.cpp SerialTx.cpp
+// libs: -lcrypto
+
+#include "hosttest.h"
+#include "UdpControl.h"
+#include "Groups.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+#include "SerialTx.h"
+#include <bearssl/bearssl_hmac.h>
+#include <lwip/igmp.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+SerialTx serialTx;
+Logger logger;
+RemoteRelaySettings settings;
+UdpControl udpControl;
+Groups groups;
+RelayQueue relayQueue;
+TimerWheel timerWheel;
+
+static const unsigned int BOARDS = 12;
+static const unsigned int MEMBERS = 10;
+static const unsigned int ROUNDS = 8;
+static const IPAddress GROUP_ADDRESS(239, 82, 82, 1);
+
+static int64_t monotonicNs() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// only crc8() is needed from RemoteRelaySettings.cpp, same polynomial
+uint8_t RemoteRelaySettings::crc8(const uint8_t *addr, size_t len) {
+  uint8_t crc = 0;
+  while (len--) {
+    uint8_t inbyte = *(addr++);
+    for (uint8_t i = 8; i --> 0;) {
+      const uint8_t mix = (crc ^ inbyte) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0b10001100;
+      }
+      inbyte >>= 1;
+    }
+  }
+  return crc;
+}
+
+const ip4_addr_t ip_addr_any4 = {0};
+err_t igmp_joingroup(const ip4_addr_t *, const ip4_addr_t *) { return ERR_OK; }
+err_t igmp_leavegroup(const ip4_addr_t *, const ip4_addr_t *) { return ERR_OK; }
+
+/**
+ * What a board tells the parent about each setChannels().
+ */
+struct Report {
+  int64_t ns;
+  uint8_t mask;
+  uint8_t states;
+};
+
+// board side
+static RSTM32Mode channels[RELAY_NUMBER_OF_CHANNELS];
+static int toParent = -1;
+static int fromParent = -1;
+static std::map<const WiFiUDP *, uint16_t> ports;
+static std::string datagram;
+
+RSTM32Mode getChannel(const uint8_t channel) { return channels[channel - 1]; }
+uint8_t channelBits() {
+  uint8_t bits = 0;
+  for (uint8_t i = RELAY_NUMBER_OF_CHANNELS; i --> 0; ) {
+    bits = (bits << 1) | (channels[i] == R_CLOSE);
+  }
+  return bits;
+}
+void setChannels(const RSTM32Mode * const modes, const uint8_t mask) {
+  const int64_t ns = monotonicNs();
+  for (uint8_t i = RELAY_NUMBER_OF_CHANNELS; i --> 0; ) {
+    if (mask & (1 << i)) {
+      channels[i] = modes[i];
+    }
+  }
+  const Report report = {ns, mask, channelBits()};
+  if (write(toParent, &report, sizeof(report)) != sizeof(report)) {
+    _exit(2);
+  }
+}
+
+uint8_t WiFiUDP::begin(const uint16_t port) { ports[this] = port; return 1; }
+int WiFiUDP::parsePacket() {
+  if (ports[this] != UDP_GROUP_PORT) {
+return 0;
+  }
+  // datagrams come as [len][bytes] through the pipe
+  uint8_t len;
+  const ssize_t n = ::read(fromParent, &len, 1);
+  if (n == 0) {
+    // parent is done
+    _exit(0);
+  }
+  if (n < 0) {
+return 0;
+  }
+  datagram.resize(len);
+  if (::read(fromParent, &datagram[0], len) != len) {
+    _exit(2);
+  }
+  return len;
+}
+int WiFiUDP::read(unsigned char * const buffer, const size_t len) {
+  const size_t n = min(len, datagram.size());
+  memcpy(buffer, datagram.data(), n);
+  return n;
+}
+IPAddress WiFiUDP::remoteIP() { return IPAddress(192, 168, 0, 2); }
+uint16_t WiFiUDP::remotePort() { return 40000; }
+IPAddress WiFiUDP::destinationIP() { return GROUP_ADDRESS; }
+int WiFiUDP::beginPacket(IPAddress, uint16_t) { return 1; }
+size_t WiFiUDP::write(const uint8_t *, const size_t n) { return n; }
+int WiFiUDP::endPacket() { return 1; }
+size_t WiFiUDP::write(uint8_t) { return 0; }
+int WiFiUDP::read() { return -1; }
+int WiFiUDP::available() { return 0; }
+int WiFiUDP::peek() { return -1; }
+
+/**
+ * loop() of board i, member of group 1 on one channel unless it's one of the last ones.
+ */
+[[noreturn]] static void runBoard(const unsigned int i) {
+  strcpy(settings.login, "admin");
+  strcpy(settings.password, "secret");
+  groups.begin();
+  if (i < MEMBERS) {
+    CHECK(groups.add({.address = GROUP_ADDRESS, .group = 1, .channels = (uint8_t) (1 << (i % RELAY_NUMBER_OF_CHANNELS)), .reserved = 0}));
+  }
+  udpControl.begin(RELAY_NUMBER_OF_CHANNELS);
+  fcntl(fromParent, F_SETFL, O_NONBLOCK);
+  srand(i);
+  while (true) {
+    hosttest::now = monotonicNs() / 1000000;
+    udpControl.service();
+    timerWheel.service();
+    relayQueue.service();
+    // the rest of the loop (web server, serial, MQTT) as up to 1 ms of other work. Sleeping
+    // rather than spinning, so twelve boards don't measure the host's scheduler.
+    usleep(rand() % 1000);
+  }
+}
+
+static std::string groupCommand(const uint32_t seq, const uint8_t group, const uint8_t mode) {
+  const char body[] = {'R', 'U', 0x02, 1, (char) (seq >> 24), (char) (seq >> 16), (char) (seq >> 8), (char) seq, (char) group, (char) mode};
+  std::string s(body, sizeof(body));
+  uint8_t tag[32];
+  unsigned int len;
+  HMAC(EVP_sha256(), "admin:secret", 12, (const uint8_t *) s.data(), s.size(), tag, &len);
+  s.append((const char *) tag, UDPCONTROL_TAG_LEN);
+  return (char) s.size() + s;
+}
+
+/**
+ * Hands the datagram to all boards, in a different order each time.
+ * @returns reports per board until quiet for a while
+ */
+static std::vector<std::vector<Report>> multicast(const std::string &framed, const int *toBoards, const int *fromBoards, const unsigned int round) {
+  std::vector<unsigned int> order(BOARDS);
+  for (unsigned int i = 0; i < BOARDS; ++i) {
+    order[i] = (i * 5 + round) % BOARDS;
+  }
+  for (const unsigned int i : order) {
+    if (write(toBoards[i], framed.data(), framed.size()) != (ssize_t) framed.size()) {
+      perror("write");
+    }
+  }
+  std::vector<std::vector<Report>> reports(BOARDS);
+  pollfd p[BOARDS];
+  for (unsigned int i = 0; i < BOARDS; ++i) {
+    p[i] = {fromBoards[i], POLLIN, 0};
+  }
+  // longer than the minimum switching interval, nothing is deferred into the next round
+  while (poll(p, BOARDS, 300) > 0) {
+    for (unsigned int i = 0; i < BOARDS; ++i) {
+      Report report;
+      if ((p[i].revents & POLLIN) && read(fromBoards[i], &report, sizeof(report)) == sizeof(report)) {
+        reports[i].push_back(report);
+      }
+    }
+  }
+  return reports;
+}
+
+int main() {
+  int toBoards[BOARDS];
+  int fromBoards[BOARDS];
+  pid_t pids[BOARDS];
+  for (unsigned int i = 0; i < BOARDS; ++i) {
+    int down[2];
+    int up[2];
+    if (pipe(down) != 0 || pipe(up) != 0) {
+      perror("pipe");
+return 1;
+    }
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      // the parent's ends of all boards so far, or they never see EOF
+      for (unsigned int j = 0; j < i; ++j) {
+        close(toBoards[j]);
+        close(fromBoards[j]);
+      }
+      close(down[1]);
+      close(up[0]);
+      fromParent = down[0];
+      toParent = up[1];
+      runBoard(i);
+    }
+    close(down[0]);
+    close(up[1]);
+    toBoards[i] = down[1];
+    fromBoards[i] = up[0];
+  }
+  // boards set up
+  usleep(200000);
+
+  std::vector<double> skews;
+  std::vector<double> latencies;
+  std::string last;
+  for (unsigned int round = 0; round <= ROUNDS; ++round) {
+    // the last round replays the one before
+    const bool replay = round == ROUNDS;
+    const uint8_t mode = (round % 2) ? R_OPEN : R_CLOSE;
+    const std::string framed = replay ? last : groupCommand(1000 + round, 1, mode);
+    last = framed;
+    const int64_t sent = monotonicNs();
+    const std::vector<std::vector<Report>> reports = multicast(framed, toBoards, fromBoards, round);
+
+    int64_t first = INT64_MAX;
+    int64_t lastSwitch = INT64_MIN;
+    for (unsigned int i = 0; i < BOARDS; ++i) {
+      if (replay || i >= MEMBERS) {
+        CHECK(reports[i].empty());
+    continue;
+      }
+      const uint8_t bit = 1 << (i % RELAY_NUMBER_OF_CHANNELS);
+      if (!CHECK(reports[i].size() == 1 && reports[i][0].mask == bit && (reports[i][0].states == (mode == R_CLOSE ? bit : 0)))) {
+    continue;
+      }
+      first = std::min(first, reports[i][0].ns);
+      lastSwitch = std::max(lastSwitch, reports[i][0].ns);
+    }
+    if (!replay && first <= lastSwitch) {
+      skews.push_back((lastSwitch - first) / 1e6);
+      latencies.push_back((first - sent) / 1e6);
+    }
+  }
+
+  for (unsigned int i = 0; i < BOARDS; ++i) {
+    close(toBoards[i]);
+    int status;
+    waitpid(pids[i], &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  if (!CHECK(skews.size() == ROUNDS)) {
+return 1;
+  }
+  std::sort(skews.begin(), skews.end());
+  std::sort(latencies.begin(), latencies.end());
+  printf("%u boards, %u members, %u commands: skew median %.2f ms, max %.2f ms; first switch after %.2f ms (median)\n",
+    BOARDS, MEMBERS, ROUNDS, skews[ROUNDS / 2], skews.back(), latencies[ROUNDS / 2]);
+
+  return hosttest::failures != 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * Keyword lookup: PerfectHash against a binary search over sorted String tables like the one it
+ * replaced, for the settings parameters of POST /settings and the AT commands. The AT parser used
+ * to build its String table for every line, that's measured as well. The search is a correct one
+ * with half-open bounds, the one replaced mixed inclusive and exclusive upper bounds.
+ */
+
+#include "hosttest.h"
+#include "PerfectHash.h"
+#include "WebHelper.h"
+#include "ATReplies.h"
+#include <algorithm>
+#include <time.h>
+#include <vector>
+
+#define GENERATE_STRING(STRING) #STRING,
+static constexpr const char *WEB_PARAM[] = { FOREACH_FRUIT1(GENERATE_STRING) };
+static constexpr const char *AT_COMMAND[] = { MyATCommand_gen(GENERATE_STRING) };
+#undef GENERATE_STRING
+static constexpr size_t WEB_PARAM_COUNT = sizeof(WEB_PARAM) / sizeof(WEB_PARAM[0]);
+static constexpr size_t AT_COMMAND_COUNT = sizeof(AT_COMMAND) / sizeof(AT_COMMAND[0]);
+static_assert(AT_COMMAND_COUNT == at_replies::INVALID_EXPECTED_AT, "one string per MyATCommand");
+static constexpr PerfectHash<WEB_PARAM_COUNT, 5> WEB_PARAM_HASH(WEB_PARAM);
+static constexpr PerfectHash<AT_COMMAND_COUNT, 5> AT_COMMAND_HASH(AT_COMMAND);
+
+static const unsigned long ROUNDS = 2000000;
+
+static double nsPerLookup(const timespec &start, const unsigned long lookups) {
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / lookups;
+}
+
+/**
+ * @returns index of value in the sorted table, N if it's not there
+ */
+static size_t binarySearch(const String * const sorted, const size_t n, const String &value) {
+  size_t lower = 0;
+  size_t upper = n;
+  while (lower < upper) {
+    const size_t pivot = lower + (upper - lower) / 2;
+    const int diff = value.compareTo(sorted[pivot]);
+    if (diff == 0) {
+return pivot;
+    }
+    if (diff > 0) {
+      lower = pivot + 1;
+    } else {
+      upper = pivot;
+    }
+  }
+  return n;
+}
+
+/**
+ * Runs both lookups over all keys of one table and one miss.
+ */
+template<size_t N, uint8_t BITS>
+static void compare(const char * const name, const char * const (&keys)[N], const PerfectHash<N, BITS> &hash, const bool tablePerLookup) {
+  // call sites pass String/char buffers, not the literals themselves
+  std::string inputs[N + 1];
+  for (size_t i = 0; i < N; ++i) {
+    inputs[i] = keys[i];
+  }
+  inputs[N] = "unknown";
+  std::vector<std::string> sorted(keys, keys + N);
+  std::sort(sorted.begin(), sorted.end());
+
+  String strings[N + 1];
+  for (size_t i = 0; i <= N; ++i) {
+    strings[i] = inputs[i].c_str();
+  }
+  String table[N];
+  for (size_t i = 0; i < N; ++i) {
+    table[i] = sorted[i].c_str();
+  }
+  for (size_t i = 0; i < N; ++i) {
+    CHECK(hash.find(inputs[i].data(), inputs[i].size()) == i);
+    CHECK(binarySearch(table, N, strings[i]) != N);
+  }
+  CHECK(hash.find(inputs[N].data(), inputs[N].size()) == N);
+  CHECK(binarySearch(table, N, strings[N]) == N);
+
+  timespec start;
+  volatile size_t sink = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned long r = 0; r < ROUNDS; ++r) {
+    const std::string &input = inputs[r % (N + 1)];
+    sink = sink + hash.find(input.data(), input.size());
+  }
+  const double hashNs = nsPerLookup(start, ROUNDS);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned long r = 0; r < ROUNDS; ++r) {
+    if (tablePerLookup) {
+      // the old parser also copied the command out of the line
+      const String input(inputs[r % (N + 1)].c_str());
+      String perLine[N];
+      for (size_t i = 0; i < N; ++i) {
+        perLine[i] = sorted[i].c_str();
+      }
+      sink = sink + binarySearch(perLine, N, input);
+    } else {
+      // the settings handler already has the parameter name as String
+      sink = sink + binarySearch(table, N, strings[r % (N + 1)]);
+    }
+  }
+  const double searchNs = nsPerLookup(start, ROUNDS);
+
+  printf("%s: perfect hash %.1f ns, binary search %.1f ns per lookup%s\n",
+    name, hashNs, searchNs, tablePerLookup ? " (String table built per line)" : "");
+}
+
+int main() {
+  compare("settings", WEB_PARAM, WEB_PARAM_HASH, false);
+  compare("AT commands", AT_COMMAND, AT_COMMAND_HASH, true);
+
+  return hosttest::failures != 0;
+}
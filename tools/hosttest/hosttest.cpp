@@ -0,0 +1,149 @@
+/**
+ * Definitions behind the stub headers, shared by all host tests.
+ */
+
+#include "hosttest.h"
+#include <IPAddress.h>
+#include <stdexcept>
+
+namespace hosttest {
+
+unsigned long now = 0;
+std::string serialOut;
+size_t serialRoom = SIZE_MAX;
+std::vector<uint8_t> flash(1 << 20, 0xFF);
+long flashOpsUntilPowerCut = -1;
+unsigned long flashWrites = 0;
+unsigned long flashErases = 0;
+int failures = 0;
+
+bool check(const bool ok, const char * const what, const char * const file, const int line) {
+  if (!ok) {
+    ++failures;
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+  }
+  return ok;
+}
+
+/**
+ * @returns false if the power is cut during this operation
+ */
+static bool flashOp() {
+  if (flashOpsUntilPowerCut < 0) {
+return true;
+  }
+  return flashOpsUntilPowerCut-- > 0;
+}
+
+}
+
+using namespace hosttest;
+
+unsigned long millis() { return now; }
+unsigned long micros() { return now * 1000; }
+void delay(const unsigned long ms) { now += ms; }
+void yield() {}
+
+/**
+ * Arduino String on top of std::string, the stub only has room for a pointer.
+ */
+static std::string &stdString(const String *s) { return **(std::string * const *) s; }
+String::String(const char * const s) { *(std::string **) this = new std::string(s ? s : ""); }
+String::String(const __FlashStringHelper * const s) : String((const char *) s) {}
+String::String(const int v) : String(std::to_string(v).c_str()) {}
+String::String(const String &o) : String(o.c_str()) {}
+String::~String() { delete *(std::string **) this; }
+String &String::operator=(const String &o) { stdString(this) = stdString(&o); return *this; }
+unsigned int String::length() const { return stdString(this).size(); }
+int String::compareTo(const String &o) const { return stdString(this).compare(stdString(&o)); }
+const char *String::c_str() const { return stdString(this).c_str(); }
+bool String::reserve(const unsigned int n) { stdString(this).reserve(n); return true; }
+bool String::concat(const char * const s) { stdString(this) += s; return true; }
+String &String::operator+=(const char * const s) { stdString(this) += s; return *this; }
+String &String::operator+=(const String &s) { stdString(this) += stdString(&s); return *this; }
+String String::substring(const unsigned int from, const unsigned int to) const { return String(stdString(this).substr(from, to - from).c_str()); }
+const String emptyString;
+
+IPAddress::IPAddress() {}
+IPAddress::IPAddress(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) : addr_(a | b << 8 | c << 16 | (uint32_t) d << 24) {}
+IPAddress::IPAddress(const uint32_t addr) : addr_(addr) {}
+IPAddress::operator uint32_t() const { return addr_; }
+uint8_t IPAddress::operator[](const int i) const { return addr_ >> (8 * i); }
+String IPAddress::toString() const { return String((std::to_string((*this)[0]) + "." + std::to_string((*this)[1]) + "." + std::to_string((*this)[2]) + "." + std::to_string((*this)[3])).c_str()); }
+bool IPAddress::isV4() const { return true; }
+bool IPAddress::operator==(const IPAddress &o) const { return addr_ == o.addr_; }
+
+size_t Print::write(const uint8_t * const bytes, const size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    write(bytes[i]);
+  }
+  return n;
+}
+size_t Print::println(const char * const s) { return write((const uint8_t *) s, strlen(s)) + write((const uint8_t *) "\r\n", 2); }
+size_t Print::println(const __FlashStringHelper * const s) { return println((const char *) s); }
+size_t Print::println() { return write((const uint8_t *) "\r\n", 2); }
+size_t Print::print(const char * const s) { return write((const uint8_t *) s, strlen(s)); }
+int Print::availableForWrite() { return 0; }
+void Print::flush() {}
+void Stream::setTimeout(unsigned long) {}
+
+size_t HardwareSerial::write(const uint8_t c) { return write(&c, 1); }
+size_t HardwareSerial::write(const uint8_t * const bytes, const size_t n) {
+  if (serialRoom != SIZE_MAX) {
+    if (n > serialRoom) {
+      throw std::logic_error("more written to Serial than availableForWrite()");
+    }
+    serialRoom -= n;
+  }
+  serialOut.append((const char *) bytes, n);
+  return n;
+}
+int HardwareSerial::available() { return 0; }
+int HardwareSerial::read() { return -1; }
+int HardwareSerial::peek() { return -1; }
+int HardwareSerial::availableForWrite() { return min(serialRoom, (size_t) INT16_MAX); }
+HardwareSerial Serial;
+
+void EspClass::wdtFeed() {}
+uint32_t EspClass::getChipId() { return 0x123456; }
+uint32_t EspClass::getFreeHeap() { return 30000; }
+uint32_t EspClass::getFlashChipSize() { return flash.size(); }
+uint32_t EspClass::random() { return ::random(); }
+String EspClass::getSketchMD5() { return String("0123456789abcdef0123456789abcdef"); }
+
+bool EspClass::flashRead(const uint32_t address, uint32_t * const data, const size_t size) {
+  memcpy(data, &flash.at(address + size - 1) - (size - 1), size);
+  return true;
+}
+
+bool EspClass::flashWrite(const uint32_t address, const uint32_t * const data, const size_t size) {
+  if (address % 4 != 0 || size % 4 != 0 || address / 256 != (address + size - 1) / 256) {
+    throw std::logic_error("unaligned flash write or across a page");
+  }
+  const bool completes = flashOp();
+  const size_t programmed = completes ? size : (size / 8) * 4;
+  const uint8_t * const bytes = (const uint8_t *) data;
+  for (size_t i = 0; i < programmed; ++i) {
+    flash.at(address + i) &= bytes[i];
+  }
+  ++flashWrites;
+  if (!completes) {
+    throw PowerCut();
+  }
+  return true;
+}
+
+bool EspClass::flashEraseSector(const uint32_t sector) {
+  const bool completes = flashOp();
+  uint8_t * const bytes = &flash.at((sector + 1) * FLASH_SECTOR_SIZE - 1) - (FLASH_SECTOR_SIZE - 1);
+  for (size_t i = 0; i < FLASH_SECTOR_SIZE; ++i) {
+    bytes[i] = completes ? 0xFF : (uint8_t) ::random();
+  }
+  ++flashErases;
+  if (!completes) {
+    throw PowerCut();
+  }
+  return true;
+}
+
+EspClass ESP;
@@ -0,0 +1,54 @@
+/**
+ * Host test harness: a virtual clock, a captured Serial and a flash stand-in
+ * behind the stub headers in stubs/. See run.sh.
+ */
+
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+namespace hosttest {
+
+/**
+ * Value of millis(), only moves when a test advances it.
+ */
+extern unsigned long now;
+
+/**
+ * Everything written to Serial.
+ */
+extern std::string serialOut;
+/**
+ * What Serial.availableForWrite() reports, SIZE_MAX is an endless FIFO.
+ */
+extern size_t serialRoom;
+
+/**
+ * Flash stand-in for ESP.flashRead()/flashWrite()/flashEraseSector(). Programming only
+ * clears bits, like NOR flash. Starts erased.
+ */
+extern std::vector<uint8_t> flash;
+/**
+ * Flash operations (writes and erases) left until the power is cut, negative for never.
+ * The operation that hits 0 is carried out halfway: a write programs only the first half
+ * of its words, an erase leaves the sector with garbage. Then PowerCut is thrown.
+ */
+extern long flashOpsUntilPowerCut;
+extern unsigned long flashWrites;
+extern unsigned long flashErases;
+struct PowerCut {};
+
+extern int failures;
+bool check(bool ok, const char *what, const char *file, int line);
+
+}
+
+/**
+ * Continues after a failure, so one run reports all of them. run.sh fails the test if any did.
+ */
+#define CHECK(COND) hosttest::check((COND), #COND, __FILE__, __LINE__)
+
+#endif  // HOSTTEST_H
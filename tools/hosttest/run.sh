@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Builds and runs the host tests against the sketch sources, with the stub headers in
+# stubs/ instead of the ESP8266 core. Needs g++ (and libcrypto for tests using UdpControl).
+#
+#   tools/hosttest/run.sh [test_xyz.cpp ...]    all test_*.cpp and bench_*.cpp by default
+#
+# Each test names the sketch units it links in a "// units:" line.
+
+cd "$(dirname "$0")" || exit 1
+ROOT=../..
+OUT=${TMPDIR:-/tmp}/rr-hosttest
+mkdir -p "$OUT"
+
+# 1M (64K SPIFFS) layout, see FlashReserve.h
+LAYOUT="-no-pie -Wl,--defsym,_FS_start=0x402EB000 -Wl,--defsym,_FS_end=0x402FB000"
+
+[ $# -gt 0 ] || set -- test_*.cpp bench_*.cpp
+failed=0
+for test in "$@"; do
+  [ -f "$test" ] || continue
+  name=$(basename "$test" .cpp)
+  units=$(sed -n 's#^// units: *##p' "$test" | sed "s#[^ ][^ ]*#$ROOT/&#g")
+  libs=$(sed -n 's#^// libs: *##p' "$test")
+  if ! g++ -std=gnu++17 -O2 -g -Wall -Wno-unknown-pragmas -Wno-c++20-extensions \
+      -Istubs -I. -I$ROOT -include Arduino.h \
+      $LAYOUT -o "$OUT/$name" "$test" hosttest.cpp $units $libs; then
+    echo "FAIL $name (build)"
+    failed=1
+  continue
+  fi
+  if "$OUT/$name"; then
+    echo "PASS $name"
+  else
+    echo "FAIL $name"
+    failed=1
+  fi
+done
+exit $failed
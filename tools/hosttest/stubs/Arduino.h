@@ -0,0 +1,132 @@
+#pragma once
+// Declarations of the ESP8266 Arduino core as far as the sketch uses them, for the host tests.
+// Definitions are in ../hosttest.cpp, only what the tests need.
+#include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <array>
+#include <functional>
+#include <memory>
+#include <utility>
+typedef uint8_t byte;
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper *>(p))
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define strncpy_P strncpy
+#define strlen_P strlen
+extern "C" size_t strlcpy(char*, const char*, size_t);
+#define memcpy_P memcpy
+#define strncmp_P strncmp
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define LED_BUILTIN 2
+#define LOW 0
+#define HIGH 1
+#define OUTPUT 1
+#define FLASH_SECTOR_SIZE 0x1000
+#define SPI_FLASH_SEC_SIZE 0x1000
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void yield();
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+class String {
+  void *impl;
+ public:
+  String(const char *s = "");
+  String(const __FlashStringHelper *);
+  String(int);
+  String(const String&);
+  ~String();
+  String &operator=(const String&);
+  unsigned int length() const;
+  String substring(unsigned int, unsigned int) const;
+  char operator[](unsigned int) const; char charAt(unsigned int) const;
+  const char *c_str() const;
+  bool reserve(unsigned int);
+  bool concat(const char*);
+  bool concat(const String&);
+  String &operator+=(const char*);
+  String &operator+=(const String&);
+  String &operator+=(uint32_t);
+  String &operator+=(int);
+  bool equalsIgnoreCase(const String&) const;
+  bool startsWith(const String&) const;
+  bool operator!=(const char *) const;
+  bool operator==(const char *) const;
+  int compareTo(const String&) const;
+  String substring(unsigned int) const;
+  void toCharArray(char*, unsigned int) const;
+  long toInt() const;
+};
+String operator+(const String&, const String&);
+String operator+(const char*, const String&);
+String operator+(const String&, const char*);
+extern const String emptyString;
+class Print {
+ public:
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *b, size_t n);
+  size_t write(const char *s);
+  size_t write(const char *s, size_t n);
+  size_t print(const char*);
+  size_t print(const __FlashStringHelper *);
+  size_t println(const char*);
+  size_t println(const __FlashStringHelper *);
+  size_t println();
+  size_t printf(const char*, ...);
+  virtual int availableForWrite();
+  virtual void flush();
+};
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  String readStringUntil(char);
+  size_t readBytesUntil(char, char*, size_t);
+  size_t readBytes(char*, size_t);
+  void setTimeout(unsigned long);
+};
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long);
+  size_t write(uint8_t) override;
+  size_t write(const uint8_t *b, size_t n) override;
+  using Print::write;
+  int available() override; int read() override; int peek() override;
+  int availableForWrite() override;
+};
+extern HardwareSerial Serial;
+struct FlashMode {};
+class EspClass {
+ public:
+  void wdtFeed(); void restart(); void deepSleep(uint64_t);
+  uint32_t getChipId(); uint32_t random(); uint32_t getFreeHeap(); void getHeapStats(uint32_t* = nullptr, uint16_t* = nullptr, uint8_t* = nullptr); uint32_t getFlashChipSize(); uint32_t getMaxFreeBlockSize();
+  String getSketchMD5();
+  uint8_t getHeapFragmentation();
+  bool flashEraseSector(uint32_t); bool flashWrite(uint32_t, const uint32_t*, size_t); bool flashRead(uint32_t, uint32_t*, size_t);
+  bool flashWrite(uint32_t, const uint8_t*, size_t); bool flashRead(uint32_t, uint8_t*, size_t);
+  uint32_t getCycleCount();
+};
+extern EspClass ESP;
+#include <algorithm>
+using std::min; using std::max;
+#include <time.h>
+#include <sys/time.h>
+#include <sys/timex.h>
+#undef STA_MODE
+void configTime(const char* tz, const char* server1, const char* server2 = nullptr, const char* server3 = nullptr);
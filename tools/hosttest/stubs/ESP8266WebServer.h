@@ -0,0 +1,50 @@
+#pragma once
+#include <ESP8266WiFi.h>
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+namespace esp8266webserver {
+template<typename ServerType> class ESP8266WebServerTemplate;
+template<typename ServerType> class RequestHandler {
+ public:
+  using WebServerType = ESP8266WebServerTemplate<ServerType>;
+  virtual ~RequestHandler() { }
+  virtual bool canHandle(HTTPMethod method, const String& uri) { (void) method; (void) uri; return false; }
+  virtual bool canUpload(const String& uri) { (void) uri; return false; }
+  virtual bool handle(WebServerType& server, HTTPMethod requestMethod, const String& requestUri) { (void) server; (void) requestMethod; (void) requestUri; return false; }
+  RequestHandler<ServerType>* next() { return _next; }
+  void next(RequestHandler<ServerType>* r) { _next = r; }
+ private:
+  RequestHandler<ServerType>* _next = nullptr;
+};
+template<typename ServerType> class ESP8266WebServerTemplate {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+  ESP8266WebServerTemplate(int port = 80);
+  void on(const String &uri, THandlerFunction handler);
+  void on(const String &uri, HTTPMethod method, THandlerFunction fn);
+  void addHandler(RequestHandler<ServerType>* handler);
+  void onNotFound(THandlerFunction fn);
+  const String& uri() const; HTTPMethod method() const;
+  WiFiClient& client();
+  const String& arg(const String& name) const; const String& arg(int i) const; const String& argName(int i) const; int args() const; bool hasArg(const String& name) const;
+  void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+  const String& header(const String& name) const; const String& header(int i) const; const String& headerName(int i) const; int headers() const; bool hasHeader(const String& name) const;
+  bool authenticate(const char * username, const char * password);
+  void requestAuthentication();
+  void send(int code, const char* content_type = NULL, const String& content = emptyString);
+  void send(int code, const char *content_type, const char *content);
+  void send(int code, const char *content_type, const char *content, size_t content_length);
+  void send(int code, const char *content_type, const uint8_t *content, size_t content_length);
+  void send_P(int code, PGM_P content_type, PGM_P content);
+  void send_P(int code, PGM_P content_type, PGM_P content, size_t contentLength);
+  void setContentLength(const size_t contentLength);
+  void sendHeader(const String& name, const String& value, bool first = false);
+  void sendContent(const String& content); void sendContent(const char *content, size_t size); void sendContent_P(PGM_P content); void sendContent_P(PGM_P content, size_t size);
+  bool chunkedResponseModeStart(int code, const char* contentType);
+  void chunkedResponseFinalize();
+  void keepAlive(bool);
+  void handleClient();
+};
+}
+using ESP8266WebServer = esp8266webserver::ESP8266WebServerTemplate<WiFiServer>;
+using RequestHandler = esp8266webserver::RequestHandler<WiFiServer>;
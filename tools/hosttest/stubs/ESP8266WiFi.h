@@ -0,0 +1,21 @@
+#pragma once
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <memory>
+#define WL_CONNECTED 3
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+class WiFiClient : public Stream {
+ public:
+  WiFiClient(); WiFiClient(const WiFiClient&); WiFiClient &operator=(const WiFiClient&); virtual ~WiFiClient();
+  int connect(const char*, uint16_t); int connect(IPAddress, uint16_t);
+  uint8_t connected(); void stop(); explicit operator bool();
+  size_t write(uint8_t) override; size_t write(const uint8_t*, size_t) override; using Print::write;
+  int available() override; int read() override; int peek() override; int read(uint8_t*, size_t);
+  int availableForWrite() override; size_t write_P(const char*, size_t); void setNoDelay(bool); IPAddress remoteIP(); uint16_t remotePort(); uint16_t localPort();
+  void keepAlive(uint16_t idle_sec = 7200, uint16_t intv_sec = 75, uint8_t count = 9);
+  bool operator==(const WiFiClient&) const;
+  std::shared_ptr<int> fd_;
+};
+class WiFiServer { public: WiFiServer(uint16_t); void begin(); WiFiClient available(); WiFiClient accept(); bool hasClient(); void setNoDelay(bool); uint8_t status(); void stop(); };
+class ESP8266WiFiClass { public: IPAddress localIP(); IPAddress subnetMask(); IPAddress softAPIP(); int status(); bool mode(WiFiMode_t); String macAddress(); };
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,4 @@
+#pragma once
+#include <Arduino.h>
+class IPAddress { public: IPAddress(); IPAddress(uint8_t,uint8_t,uint8_t,uint8_t); IPAddress(uint32_t); operator uint32_t() const; String toString() const; bool fromString(const char*); bool fromString(const String&); uint8_t operator[](int) const; bool isV4() const; bool operator==(const IPAddress&) const;
+  uint32_t addr_ = 0; };
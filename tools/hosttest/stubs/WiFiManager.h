@@ -0,0 +1,12 @@
+#pragma once
+#include <ESP8266WebServer.h>
+#include <DNSServer.h>
+class WiFiManagerParameter { public: WiFiManagerParameter(const char*, const char*, const char*, int, const char* custom = ""); };
+class WiFiManager { public:
+  std::unique_ptr<ESP8266WebServer> server;
+  void setConfigPortalBlocking(bool); void setRemoveDuplicateAPs(bool); void addParameter(WiFiManagerParameter*);
+  void setSaveConfigCallback(std::function<void()>); void setWebServerCallback(std::function<void()>);
+  void disconnect(); void setCaptivePortalEnable(bool); void setEnableConfigPortal(bool); void setSaveConnect(bool);
+  bool startConfigPortal(const char*, const char*); bool autoConnect(const char*, const char*); void startWebPortal(); void stopWebPortal();
+  bool process(); void resetSettings(); void setHttpPort(uint16_t); bool getWebPortalActive(); bool getConfigPortalActive();
+};
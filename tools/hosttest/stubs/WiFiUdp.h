@@ -0,0 +1,8 @@
+#pragma once
+#include <ESP8266WiFi.h>
+class WiFiUDP : public Stream { public:
+  uint8_t begin(uint16_t); uint8_t beginMulticast(IPAddress, IPAddress, uint16_t); void stop();
+  int parsePacket(); int read(unsigned char*, size_t); int read() override; int available() override; int peek() override;
+  IPAddress remoteIP(); uint16_t remotePort(); IPAddress destinationIP();
+  int beginPacket(IPAddress, uint16_t); int beginPacketMulticast(IPAddress, uint16_t, IPAddress, int ttl=1); int endPacket();
+  size_t write(uint8_t) override; size_t write(const uint8_t*, size_t) override; using Print::write; };
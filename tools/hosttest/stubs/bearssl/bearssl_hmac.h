@@ -0,0 +1,13 @@
+#pragma once
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#include <openssl/hmac.h>
+#include <string.h>
+typedef struct { int dummy; } br_hash_class;
+static const br_hash_class br_sha256_vtable = {0};
+typedef struct { unsigned char key[64]; size_t len; } br_hmac_key_context;
+typedef struct { HMAC_CTX *c; size_t out; } br_hmac_context;
+static inline void br_hmac_key_init(br_hmac_key_context *kc, const br_hash_class *const*, const void *key, size_t len) { memcpy(kc->key, key, len); kc->len = len; }
+static inline void br_hmac_key_init(br_hmac_key_context *kc, const br_hash_class *, const void *key, size_t len) { memcpy(kc->key, key, len); kc->len = len; }
+static inline void br_hmac_init(br_hmac_context *ctx, const br_hmac_key_context *kc, size_t out) { ctx->c = HMAC_CTX_new(); HMAC_Init_ex(ctx->c, kc->key, kc->len, EVP_sha256(), NULL); ctx->out = out; }
+static inline void br_hmac_update(br_hmac_context *ctx, const void *d, size_t l) { HMAC_Update(ctx->c, (const unsigned char*)d, l); }
+static inline size_t br_hmac_out(const br_hmac_context *ctx, void *out) { unsigned char f[32]; unsigned int l; HMAC_Final(ctx->c, f, &l); HMAC_CTX_free(ctx->c); memcpy(out, f, ctx->out); return ctx->out; }
@@ -0,0 +1,8 @@
+#pragma once
+#include <lwip/igmp.h>
+typedef ip4_addr_t ip_addr_t;
+#define ERR_INPROGRESS -5
+#define ip_2_ip4(ipaddr) (ipaddr)
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
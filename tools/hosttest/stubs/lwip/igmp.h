@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+typedef struct { uint32_t addr; } ip4_addr_t;
+typedef int8_t err_t;
+#define ERR_OK 0
+extern const ip4_addr_t ip_addr_any4;
+#define IP4_ADDR_ANY4 (&ip_addr_any4)
+err_t igmp_joingroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr);
+err_t igmp_leavegroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr);
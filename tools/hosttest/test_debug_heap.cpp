@@ -0,0 +1,90 @@
+/**
+ * GET /debug streams the log through a fixed buffer: the heap used while the log is
+ * read stays the same (none) however full the ring is. The sink has the same shape
+ * as the one of handleGETDebug().
+ */
+// units: Logger.cpp SerialTx.cpp
+
+#include "hosttest.h"
+#include "Logger.h"
+#include "SerialTx.h"
+#include <new>
+
+SerialTx serialTx;
+Logger logger;
+
+static bool counting = false;
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+static unsigned int allocations = 0;
+
+void *operator new(const size_t size) {
+  // size in front of the block, for operator delete
+  size_t * const block = (size_t *) malloc(sizeof(size_t) + size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  *block = size;
+  if (counting) {
+    ++allocations;
+    liveBytes += size;
+    peakBytes = max(peakBytes, liveBytes);
+  }
+  return block + 1;
+}
+
+void operator delete(void * const p) noexcept {
+  if (p == nullptr) {
+return;
+  }
+  size_t * const block = (size_t *) p - 1;
+  if (counting) {
+    liveBytes -= min(liveBytes, *block);
+  }
+  free(block);
+}
+
+void operator delete(void * const p, size_t) noexcept {
+  operator delete(p);
+}
+
+/**
+ * Stands in for the chunked response.
+ */
+struct Response {
+  size_t sent = 0;
+  void sendContent(const char *, const size_t len) { sent += len; }
+};
+
+/**
+ * @returns bytes of log sent, the allocations are in the counters
+ */
+static size_t readLog() {
+  Response response;
+  allocations = 0;
+  liveBytes = 0;
+  peakBytes = 0;
+  counting = true;
+  logger.getLog([&response](const char *text, size_t len) {
+    response.sendContent(text, len);
+  });
+  counting = false;
+  return response.sent;
+}
+
+int main() {
+  const size_t emptySent = readLog();
+  CHECK(allocations == 0 && peakBytes == 0);
+
+  // full ring, text and deferred records
+  for (int i = 0; i < 1000; ++i) {
+    logger.logNow("{'text': 'some fairly long line of the log, to fill the ring with'}");
+    LOG_INFO("{'channel': %c, 'state': '%.3s', 'n': %d}", '1', "off", i);
+  }
+  const size_t fullSent = readLog();
+  CHECK(fullSent > emptySent + RINGLOG_BYTES);
+  CHECK(allocations == 0 && peakBytes == 0);
+  printf("log of %zu bytes read, %u allocations, peak %zu bytes\n", fullSent, allocations, peakBytes);
+
+  return hosttest::failures != 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * Packed ring log: records wrap around the end of the array intact and the oldest
+ * ones are evicted whole, exactly as many as needed.
+ */
+// units: Logger.cpp SerialTx.cpp
+
+#include "hosttest.h"
+#include "Logger.h"
+#include "SerialTx.h"
+
+SerialTx serialTx;
+Logger logger;
+
+/**
+ * Text of record i, its length varies from 1 to 150 chars.
+ */
+static std::string text(const unsigned int i) {
+  std::string s = "line " + std::to_string(i) + " ";
+  s.resize(1 + (i * 37) % 150, 'a' + i % 26);
+  return s;
+}
+
+/**
+ * @returns the lines of getLog() between header and footer
+ */
+static std::vector<std::string> lines() {
+  std::string log;
+  logger.getLog([&](const char * const t, const size_t n) { log.append(t, n); });
+  std::vector<std::string> result;
+  size_t pos = log.find("lines of the log:\r\n");
+  pos += strlen("lines of the log:\r\n");
+  for (size_t end; (end = log.find("\r\n", pos)) != std::string::npos; pos = end + 2) {
+    result.push_back(log.substr(pos, end - pos));
+  }
+  CHECK(!result.empty() && result.back() == " ==== END LOG ====");
+  result.pop_back();
+  return result;
+}
+
+int main() {
+  CHECK(lines().empty());
+
+  // several times around the ring, every record checked each time
+  unsigned int written = 0;
+  for (unsigned int round = 0; round < 600; ++round) {
+    hosttest::now = written;
+    logger.logNow(text(written).c_str());
+    ++written;
+
+    const std::vector<std::string> got = lines();
+    // newest records as long as they fit, with length byte and header each
+    size_t expectedCount = 0;
+    size_t bytes = 0;
+    while (expectedCount < written) {
+      const size_t size = 1 + LOG_RECORD_HEADER + text(written - 1 - expectedCount).size();
+      if (bytes + size > RINGLOG_BYTES) {
+    break;
+      }
+      bytes += size;
+      ++expectedCount;
+    }
+    if (!CHECK(got.size() == expectedCount)) {
+return 1;
+    }
+    for (size_t k = 0; k < got.size(); ++k) {
+      const unsigned int i = written - expectedCount + k;
+      char prefix[16];
+      snprintf(prefix, sizeof(prefix), "[%07u] ", i);
+      CHECK(got[k] == prefix + text(i));
+    }
+    CHECK(logger.getHeadSeq() == written);
+  }
+  CHECK(written > 3 * RINGLOG_BYTES / (1 + LOG_RECORD_HEADER + 150));
+
+  // incremental reads see the same records, and the gap of evicted ones
+  std::string tail;
+  logger.getLogSince(0, [&](const char * const t, const size_t n) { tail.append(t, n); });
+  const std::vector<std::string> all = lines();
+  const unsigned int first = written - all.size();
+  CHECK(tail.compare(0, tail.find("\r\n"), "head=" + std::to_string(written) + " gap=" + std::to_string(first)) == 0);
+  tail.clear();
+  logger.getLogSince(written - 2, [&](const char * const t, const size_t n) { tail.append(t, n); });
+  CHECK(tail == "head=" + std::to_string(written) + " gap=0\r\n"
+    + std::to_string(written - 2) + " " + all[all.size() - 2] + "\r\n"
+    + std::to_string(written - 1) + " " + all[all.size() - 1] + "\r\n");
+
+  return hosttest::failures != 0;
+}
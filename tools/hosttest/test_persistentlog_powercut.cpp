@@ -0,0 +1,140 @@
+/**
+ * Persistent log against the flash stand-in: the power is cut at every flash operation of
+ * a boot in turn (halfway through a page program or a sector erase). The next boot has
+ * to read back what was written before, record by record, without torn or foreign records,
+ * and go on logging. Enough is logged for the pages to wrap around the sectors.
+ */
+// units: PersistentLog.cpp SerialTx.cpp
+
+#include "hosttest.h"
+#include "PersistentLog.h"
+#include "RemoteRelaySettings.h"
+#include "SerialTx.h"
+#include <map>
+
+SerialTx serialTx;
+
+// only crc8() is needed from RemoteRelaySettings.cpp, same polynomial
+uint8_t RemoteRelaySettings::crc8(const uint8_t *addr, size_t len) {
+  uint8_t crc = 0;
+  while (len--) {
+    uint8_t inbyte = *(addr++);
+    for (uint8_t i = 8; i --> 0;) {
+      const uint8_t mix = (crc ^ inbyte) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0b10001100;
+      }
+      inbyte >>= 1;
+    }
+  }
+  return crc;
+}
+
+static std::string record(const unsigned int boot, const unsigned int i) {
+  std::string s = "boot " + std::to_string(boot) + " record " + std::to_string(i) + " ";
+  s.resize(20 + (boot * 7 + i * 13) % 100, '.');
+  return s;
+}
+
+/**
+ * One boot appending count records, flushing every few like service() would.
+ * @returns number of records that were flushed completely before the power was cut
+ */
+static unsigned int runBoot(const unsigned int boot, const unsigned int count, unsigned int &bootId) {
+  PersistentLog log;
+  log.begin();
+  bootId = log.getBoot();
+  unsigned int flushed = 0;
+  try {
+    for (unsigned int i = 0; i < count; ++i) {
+      const std::string r = record(boot, i);
+      CHECK(log.append((const uint8_t *) r.data(), r.size()));
+      if (i % 5 == 4 || i + 1 == count) {
+        log.flush();
+        flushed = i + 1;
+      }
+    }
+  } catch (const hosttest::PowerCut &) {
+  }
+  return flushed;
+}
+
+/**
+ * Records by boot id, as the next boot reads them.
+ */
+static std::map<unsigned int, std::vector<std::string>> readBack() {
+  PersistentLog log;
+  log.begin();
+  std::map<unsigned int, std::vector<std::string>> result;
+  PersistentLog::Cursor cursor;
+  log.rewind(cursor);
+  uint8_t buffer[255];
+  uint8_t len;
+  while ((len = log.read(cursor, buffer)) > 0) {
+    result[cursor.header.boot].push_back(std::string((const char *) buffer, len));
+  }
+  return result;
+}
+
+/**
+ * @returns true if got is an intact run of boot's records ending at (or after) minEnd
+ */
+static bool isRun(const std::vector<std::string> &got, const unsigned int boot, const unsigned int minEnd, const unsigned int maxEnd) {
+  if (got.empty()) {
+return minEnd == 0;
+  }
+  unsigned int first = 0;
+  while (first < maxEnd && record(boot, first) != got[0]) {
+    ++first;
+  }
+  for (size_t k = 0; k < got.size(); ++k) {
+    if (first + k >= maxEnd || got[k] != record(boot, first + k)) {
+return false;
+    }
+  }
+  const unsigned int end = first + got.size();
+  return end >= minEnd && end <= maxEnd;
+}
+
+int main() {
+  // records in the previous boot and in the cut one, the sectors hold about 100
+  const unsigned int PREVIOUS = 150;
+  const unsigned int COUNT = 40;
+  // the cut boot does about this many flash operations
+  unsigned long maxOps = 0;
+  for (long cut = 0; cut == 0 || (unsigned long) cut <= maxOps; ++cut) {
+    std::fill(hosttest::flash.begin(), hosttest::flash.end(), 0xFF);
+    hosttest::flashOpsUntilPowerCut = -1;
+    unsigned int ids[3];
+    // boot 0 wraps around by itself, boot 1 overwrites its oldest pages
+    runBoot(0, PREVIOUS, ids[0]);
+    const unsigned long before = hosttest::flashWrites + hosttest::flashErases;
+    hosttest::flashOpsUntilPowerCut = (cut == 0) ? -1 : cut - 1;
+    const unsigned int flushed = runBoot(1, COUNT, ids[1]);
+    if (cut == 0) {
+      maxOps = hosttest::flashWrites + hosttest::flashErases - before;
+      CHECK(flushed == COUNT);
+    } else {
+      CHECK(flushed < COUNT);
+    }
+    hosttest::flashOpsUntilPowerCut = -1;
+
+    std::map<unsigned int, std::vector<std::string>> got = readBack();
+    CHECK(got.size() <= 2);
+    // the newest records of the previous boot, in order
+    CHECK(!got[ids[0]].empty() && isRun(got[ids[0]], 0, PREVIOUS, PREVIOUS));
+    if (!CHECK(isRun(got[ids[1]], 1, flushed, COUNT))) {
+      fprintf(stderr, "power cut at flash operation %ld: %zu records of boot 1 read, %u flushed\n", cut, got[ids[1]].size(), flushed);
+    }
+
+    // and the log goes on
+    runBoot(2, 10, ids[2]);
+    CHECK(ids[2] != ids[1] && ids[2] != ids[0]);
+    got = readBack();
+    CHECK(isRun(got[ids[2]], 2, 10, 10));
+  }
+  printf("power cut at each of %lu flash operations\n", maxOps);
+
+  return hosttest::failures != 0;
+}
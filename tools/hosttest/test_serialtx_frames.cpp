@@ -0,0 +1,115 @@
+/**
+ * Relay frames through SerialTx under heavy logging, with a UART FIFO that only drains at
+ * 115200 baud: every frame comes out whole, in order and never split by log text, while
+ * log lines are dropped rather than waited for. Without serial logging the UART carries
+ * the frames and replies only, no line breaks in between.
+ */
+// units: SerialTx.cpp
+
+#include "hosttest.h"
+#include "SerialTx.h"
+
+SerialTx serialTx;
+
+static const uint8_t HEADER = 0xA0;
+
+/**
+ * Frame i, like setChannel() sends it: the header never occurs in the rest.
+ */
+static std::string frame(const unsigned int i) {
+  const uint8_t bytes[4] = {HEADER, (uint8_t) (1 + i % 4), (uint8_t) (i % 2), (uint8_t) (HEADER + 1 + i % 4 + i % 2)};
+  return std::string((const char *) bytes, sizeof(bytes));
+}
+
+static std::string logLine(const unsigned int i) {
+  std::string s = "log line " + std::to_string(i) + " ";
+  s.resize(40 + (i * 31) % 140, 'a' + i % 26);
+  return s + "\r\n";
+}
+
+/**
+ * One ms of the UART: about 11 bytes leave the FIFO.
+ */
+static void tick() {
+  ++hosttest::now;
+  hosttest::serialRoom = min(hosttest::serialRoom + 11, (size_t) 128);
+  serialTx.service();
+}
+
+int main() {
+  hosttest::serialRoom = 128;
+  serialTx.setLineBreaks(true);
+  unsigned int frames = 0;
+  unsigned int lines = 0;
+  for (unsigned int ms = 0; ms < 20000; ++ms) {
+    // far more log than the line takes
+    for (int k = 0; k < 3; ++k) {
+      const std::string line = logLine(lines++);
+      serialTx.write(TX_LOG, (const uint8_t *) line.data(), line.size());
+    }
+    if (ms % 7 == 0) {
+      const std::string f = frame(frames++);
+      CHECK(serialTx.write(TX_FRAME, (const uint8_t *) f.data(), f.size()));
+    }
+    tick();
+  }
+  for (unsigned int ms = 0; ms < 1000; ++ms) {
+    tick();
+  }
+  CHECK(serialTx.getDropped(TX_LOG) > 0);
+  CHECK(serialTx.getDropped(TX_FRAME) == 0);
+
+  // frames whole and in order, whatever is around them
+  const std::string &out = hosttest::serialOut;
+  std::string text;
+  unsigned int seen = 0;
+  for (size_t pos = 0; pos < out.size(); ) {
+    if ((uint8_t) out[pos] == HEADER) {
+      if (!CHECK(out.compare(pos, 4, frame(seen)) == 0)) {
+return 1;
+      }
+      ++seen;
+      pos += 4;
+    } else {
+      text += out[pos++];
+    }
+  }
+  CHECK(seen == frames);
+
+  // without the frames the rest is whole log lines, apart from the line breaks after frames
+  unsigned int printed = 0;
+  unsigned int last = 0;
+  for (size_t pos = 0, end; (end = text.find("\r\n", pos)) != std::string::npos; pos = end + 2) {
+    const std::string line = text.substr(pos, end - pos) + "\r\n";
+    if (line == "\r\n") {
+  continue;
+    }
+    const unsigned int i = strtoul(line.c_str() + strlen("log line "), NULL, 10);
+    CHECK(line == logLine(i) && (printed == 0 || i > last));
+    last = i;
+    ++printed;
+  }
+  CHECK(printed > 0 && printed + serialTx.getDropped(TX_LOG) == lines);
+  printf("%u frames intact among %u of %u log lines\n", seen, printed, lines);
+
+  // serial logging off: nothing but frames and replies
+  serialTx.setLineBreaks(false);
+  hosttest::serialOut.clear();
+  std::string expected;
+  for (unsigned int i = 0; i < 50; ++i) {
+    const std::string f = frame(i);
+    serialTx.write(TX_FRAME, (const uint8_t *) f.data(), f.size());
+    serialTx.println(TX_REPLY, "OK");
+    expected += f + "OK\r\n";
+    tick();
+  }
+  serialTx.flush();
+  CHECK(hosttest::serialOut == expected);
+
+  // a message larger than its ring is refused instead of waited for
+  const uint8_t big[SERIALTX_FRAME_BYTES] = {HEADER};
+  CHECK(!serialTx.write(TX_FRAME, big, sizeof(big)));
+  CHECK(serialTx.getDropped(TX_FRAME) == 1);
+
+  return hosttest::failures != 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Timer wheel on a virtual clock: timers fire in the millisecond they are due (or at the
+ * first service() after it when the loop stalls), never early, also across the millis()
+ * wrap-around and beyond one turn of the wheel. Cancelled timers never fire and give their
+ * node back right away.
+ */
+// units: TimerWheel.cpp
+
+#include "hosttest.h"
+#include "TimerWheel.h"
+#include "RelayQueue.h"
+
+TimerWheel timerWheel;
+
+struct Fired {
+  unsigned long at;
+  uint8_t channel;
+  RSTM32Mode mode;
+};
+static std::vector<Fired> fired;
+
+RelayQueue::RelayQueue() {}
+void RelayQueue::request(const uint8_t channel, const RSTM32Mode mode) { fired.push_back({hosttest::now, channel, mode}); }
+RelayQueue relayQueue;
+
+/**
+ * Runs the loop until end, period gives the ms to the next service() call.
+ */
+template <typename Period>
+static void runUntil(const unsigned long end, Period period) {
+  while ((long) (end - hosttest::now) > 0) {
+    hosttest::now += min(period(), end - hosttest::now);
+    timerWheel.service();
+  }
+}
+
+/**
+ * Schedules delays[] on alternating channels, runs the loop and checks when each one fired.
+ */
+template <typename Period>
+static void checkTiming(const unsigned long start, Period period, const uint32_t maxLate) {
+  static const uint32_t delays[] = {1, 3, 255, 256, 257, 511, 750, 5000, 60000, 1200000};
+  hosttest::now = start;
+  fired.clear();
+  for (size_t i = 0; i < sizeof(delays) / sizeof(delays[0]); ++i) {
+    CHECK(timerWheel.schedule(delays[i], 1 + i % RELAY_NUMBER_OF_CHANNELS, (i % 2) ? R_CLOSE : R_OPEN));
+  }
+  runUntil(start + 1200000 + maxLate + 1, period);
+  CHECK(fired.size() == sizeof(delays) / sizeof(delays[0]));
+  CHECK(timerWheel.getPending() == 0);
+  for (const Fired &f : fired) {
+    size_t i = 0;
+    while (i < sizeof(delays) / sizeof(delays[0]) && !(f.channel == 1 + i % RELAY_NUMBER_OF_CHANNELS && f.mode == ((i % 2) ? R_CLOSE : R_OPEN)
+        && f.at - start >= delays[i] && f.at - start <= delays[i] + maxLate)) {
+      ++i;
+    }
+    if (!CHECK(i < sizeof(delays) / sizeof(delays[0]))) {
+      fprintf(stderr, "channel %u fired at +%lu\n", f.channel, f.at - start);
+    }
+  }
+}
+
+int main() {
+  // every ms, to the ms
+  checkTiming(1000, [] { return 1UL; }, 0);
+  // across the millis() wrap-around
+  checkTiming(0xFFFFFF00UL, [] { return 1UL; }, 0);
+  // a loop stalling now and then, up to more than one turn of the wheel
+  unsigned long step = 0;
+  checkTiming(5000, [&step] { ++step; return (step % 97 == 0) ? 300UL : (step % 5 == 0) ? 17UL : 1UL; }, 300);
+
+  // cancel() frees the nodes, so the pool never runs out however often commands replace timers
+  hosttest::now = 10000;
+  fired.clear();
+  CHECK(timerWheel.schedule(500, 2, R_OPEN));
+  for (unsigned int i = 0; i < 5000; ++i) {
+    timerWheel.cancel(1);
+    CHECK(timerWheel.schedule(100 + i % 700, 1, R_OPEN));
+    CHECK(timerWheel.schedule(1000 + i % 300, 1, R_CLOSE));
+    CHECK(timerWheel.getPending() == 2 + (hosttest::now < 10500));
+    ++hosttest::now;
+    timerWheel.service();
+  }
+  CHECK(fired.size() == 1 && fired[0].channel == 2 && fired[0].at == 10500);
+  // only the last command's timers
+  timerWheel.cancel(2);
+  runUntil(hosttest::now + 2000, [] { return 1UL; });
+  CHECK(fired.size() == 3);
+  CHECK(fired[1].channel == 1 && fired[1].mode == R_OPEN && fired[1].at == 14999 + 100 + 4999 % 700);
+  CHECK(fired[2].channel == 1 && fired[2].mode == R_CLOSE && fired[2].at == 14999 + 1000 + 4999 % 300);
+
+  // a full pool takes timers again after a cancel
+  for (unsigned int i = 0; i < TIMERWHEEL_NODES; ++i) {
+    CHECK(timerWheel.schedule(1000 + i, 1 + i % 2, R_OPEN));
+  }
+  CHECK(timerWheel.isFull() && !timerWheel.schedule(1000, 3, R_OPEN));
+  timerWheel.cancel(2);
+  CHECK(timerWheel.getPending() == TIMERWHEEL_NODES / 2 && !timerWheel.isFull());
+  fired.clear();
+  runUntil(hosttest::now + 2000, [] { return 1UL; });
+  CHECK(fired.size() == TIMERWHEEL_NODES / 2);
+  for (const Fired &f : fired) {
+    CHECK(f.channel == 1);
+  }
+
+  return hosttest::failures != 0;
+}
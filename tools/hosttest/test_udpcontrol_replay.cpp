@@ -0,0 +1,245 @@
+/**
+ * UDP command port against replays: a captured command must not switch again, neither
+ * from another address nor after a reboot, and the high-water mark has to survive a power
+ * cut at any flash operation of its lease. Retries of the newest command are acked without
+ * switching, a stale command tells the sender where to continue. Group commands have their own
+ * high-water mark, commands to one board don't make them stale.
+ */
+// units: UdpControl.cpp Logger.cpp SerialTx.cpp
+// libs: -lcrypto
+
+#include "hosttest.h"
+#include "UdpControl.h"
+#include "RelayQueue.h"
+#include "TimerWheel.h"
+#include "Groups.h"
+#include "SerialTx.h"
+#include <bearssl/bearssl_hmac.h>
+#include <deque>
+#include <map>
+
+SerialTx serialTx;
+Logger logger;
+RemoteRelaySettings settings;
+
+static unsigned int switched = 0;
+RelayQueue::RelayQueue() {}
+void RelayQueue::request(const RSTM32Mode *, const uint8_t) { ++switched; }
+RelayQueue relayQueue;
+TimerWheel::TimerWheel() {}
+void TimerWheel::cancel(uint8_t) {}
+TimerWheel timerWheel;
+Groups::Groups() {}
+void Groups::joinAll() {}
+uint8_t Groups::channels(uint32_t, const uint8_t group) const { return group == 7 ? 0b0001 : 0; }
+Groups groups;
+uint8_t channelBits() { return 0b0101; }
+
+/**
+ * One network for all WiFiUDP objects: datagrams by destination port.
+ */
+struct Datagram {
+  uint32_t from;
+  std::string bytes;
+};
+static std::map<uint16_t, std::deque<Datagram>> network;
+static std::map<const WiFiUDP *, uint16_t> ports;
+static std::map<const WiFiUDP *, Datagram> current;
+static std::deque<std::string> acks;
+
+uint8_t WiFiUDP::begin(const uint16_t port) { ports[this] = port; return 1; }
+int WiFiUDP::parsePacket() {
+  std::deque<Datagram> &inbox = network[ports[this]];
+  if (inbox.empty()) {
+return 0;
+  }
+  current[this] = inbox.front();
+  inbox.pop_front();
+  return current[this].bytes.size();
+}
+int WiFiUDP::read(unsigned char * const buffer, const size_t len) {
+  const size_t n = min(len, current[this].bytes.size());
+  memcpy(buffer, current[this].bytes.data(), n);
+  return n;
+}
+IPAddress WiFiUDP::remoteIP() { return IPAddress(current[this].from); }
+uint16_t WiFiUDP::remotePort() { return 40000; }
+IPAddress WiFiUDP::destinationIP() { return IPAddress(192, 168, 0, 9); }
+int WiFiUDP::beginPacket(IPAddress, uint16_t) { acks.emplace_back(); return 1; }
+size_t WiFiUDP::write(const uint8_t * const bytes, const size_t n) { acks.back().append((const char *) bytes, n); return n; }
+int WiFiUDP::endPacket() { return 1; }
+size_t WiFiUDP::write(uint8_t) { return 0; }
+int WiFiUDP::read() { return -1; }
+int WiFiUDP::available() { return 0; }
+int WiFiUDP::peek() { return -1; }
+
+static std::string tag(const std::string &data) {
+  uint8_t out[32];
+  unsigned int len;
+  HMAC(EVP_sha256(), "admin:secret", 12, (const uint8_t *) data.data(), data.size(), out, &len);
+  return std::string((const char *) out, UDPCONTROL_TAG_LEN);
+}
+
+static std::string command(const uint32_t seq, const uint8_t channel, const uint8_t mode, const uint8_t type = 0x01) {
+  const char body[] = {'R', 'U', (char) type, 1, (char) (seq >> 24), (char) (seq >> 16), (char) (seq >> 8), (char) seq, (char) channel, (char) mode};
+  const std::string s(body, sizeof(body));
+  return s + tag(s);
+}
+
+struct Ack {
+  uint8_t status;
+  uint32_t seq;
+  uint32_t high;
+};
+
+/**
+ * Delivers the datagram and services the board.
+ * @returns its ack, status 0xFF if there was none or it wasn't authentic
+ */
+static Ack deliver(UdpControl &board, const std::string &datagram, const uint32_t from = 0x0A00A8C0, const uint16_t port = UDP_CONTROL_PORT) {
+  network[port].push_back({from, datagram});
+  acks.clear();
+  board.service();
+  if (acks.size() != 1 || acks[0].size() != 14 + UDPCONTROL_TAG_LEN || tag(acks[0].substr(0, 14)) != acks[0].substr(14)) {
+return {0xFF, 0, 0};
+  }
+  const uint8_t * const a = (const uint8_t *) acks[0].data();
+  return {a[3], (uint32_t) a[4] << 24 | a[5] << 16 | a[6] << 8 | a[7], (uint32_t) a[10] << 24 | a[11] << 16 | a[12] << 8 | a[13]};
+}
+
+int main() {
+  strcpy(settings.login, "admin");
+  strcpy(settings.password, "secret");
+
+  uint32_t high;
+  {
+    UdpControl board;
+    board.begin(RELAY_NUMBER_OF_CHANNELS);
+    const std::string captured = command(1000, 1, R_CLOSE);
+    Ack ack = deliver(board, captured);
+    CHECK(ack.status == UDPCONTROL_OK && ack.seq == 1000 && ack.high == 1000 && switched == 1);
+    // retry, and the same datagram from elsewhere
+    ack = deliver(board, captured);
+    CHECK(ack.status == UDPCONTROL_OK && switched == 1);
+    ack = deliver(board, captured, 0x6400A8C0);
+    CHECK(ack.status == UDPCONTROL_OK && switched == 1);
+    CHECK(board.getDuplicates() == 2);
+    // older
+    ack = deliver(board, command(999, 2, R_CLOSE), 0x6400A8C0);
+    CHECK(ack.status == UDPCONTROL_STALE && ack.high == 1000 && switched == 1);
+    // forged
+    std::string forged = captured;
+    forged[4] = 0x7F;
+    CHECK(deliver(board, forged).status == 0xFF && board.getRejected() == 1 && switched == 1);
+    // newer, from anyone
+    ack = deliver(board, command(1001, 2, R_OPEN), 0x6400A8C0);
+    CHECK(ack.status == UDPCONTROL_OK && ack.high == 1001 && switched == 2);
+    high = 1001;
+  }
+
+  // after a reboot the captured ones stay stale, the ack tells where to continue
+  {
+    UdpControl board;
+    board.begin(RELAY_NUMBER_OF_CHANNELS);
+    Ack ack = deliver(board, command(1001, 2, R_OPEN));
+    CHECK(ack.status != UDPCONTROL_OK && ack.high >= 1001 && switched == 2);
+    ack = deliver(board, command(1002, 2, R_OPEN));
+    CHECK(ack.status == UDPCONTROL_STALE && switched == 2);
+    ack = deliver(board, command(ack.high + 1, 2, R_OPEN));
+    CHECK(ack.status == UDPCONTROL_OK && switched == 3);
+  }
+
+  // group commands count on their own: far below the seq of the commands, still new
+  {
+    UdpControl board;
+    board.begin(RELAY_NUMBER_OF_CHANNELS);
+    const unsigned int before = switched;
+    CHECK(deliver(board, command(5, 7, R_CLOSE, 0x02), 0x0A00A8C0, UDP_GROUP_PORT).status == 0xFF && switched == before + 1);
+    Ack ack = deliver(board, command(6, 7, R_OPEN, 0x03), 0x6400A8C0, UDP_GROUP_PORT);
+    CHECK(ack.status == UDPCONTROL_OK && ack.high == 6 && switched == before + 2);
+    ack = deliver(board, command(5, 7, R_CLOSE, 0x03), 0x6400A8C0, UDP_GROUP_PORT);
+    CHECK(ack.status == UDPCONTROL_STALE && ack.high == 6 && switched == before + 2);
+    // and a group for other boards doesn't use up a seq
+    CHECK(deliver(board, command(7, 8, R_CLOSE, 0x03), 0x6400A8C0, UDP_GROUP_PORT).status == 0xFF);
+    ack = deliver(board, command(7, 7, R_CLOSE, 0x03), 0x6400A8C0, UDP_GROUP_PORT);
+    CHECK(ack.status == UDPCONTROL_OK && switched == before + 3);
+    // nor the commands
+    ack = deliver(board, command(high + 1, 1, R_OPEN));
+    CHECK(ack.status == UDPCONTROL_STALE && ack.high > 7);
+  }
+
+  // the high-water marks of both kinds, as a rebooted board tells them
+  uint32_t highs[UDPCONTROL_SEQ_SPACES];
+  {
+    UdpControl board;
+    board.begin(RELAY_NUMBER_OF_CHANNELS);
+    highs[0] = deliver(board, command(1, 1, R_OPEN)).high;
+    highs[1] = deliver(board, command(1, 7, R_OPEN, 0x03), 0x0A00A8C0, UDP_GROUP_PORT).high;
+    CHECK(highs[1] >= 7 && highs[1] < highs[0]);
+  }
+
+  // leases of both kinds all the way through both sectors, with reboots and power cuts in between
+  unsigned long cuts = 0;
+  for (unsigned int i = 0; i < 1500; ++i) {
+    UdpControl board;
+    board.begin(RELAY_NUMBER_OF_CHANNELS);
+    const uint8_t kind = i % 2;
+    const uint32_t seq = highs[kind] + 1 + i % 3 * UDPCONTROL_SEQ_LEASE;
+    const unsigned int before = switched;
+    hosttest::flashOpsUntilPowerCut = (i % 7 == 0) ? i / 7 % 3 : -1;
+    try {
+      const Ack ack = deliver(board, kind ? command(seq, 7, R_OPEN, 0x03) : command(seq, 1, R_OPEN), 0x0A00A8C0, kind ? UDP_GROUP_PORT : UDP_CONTROL_PORT);
+      CHECK(ack.status == UDPCONTROL_OK && switched == before + 1);
+      highs[kind] = seq;
+      // erases the superseded sector, if any
+      board.service();
+    } catch (const hosttest::PowerCut &) {
+      ++cuts;
+    }
+    hosttest::flashOpsUntilPowerCut = -1;
+    // neither kind is ever forgotten, whether the cut came before or after switching; continue after the lease
+    UdpControl rebooted;
+    rebooted.begin(RELAY_NUMBER_OF_CHANNELS);
+    const unsigned int after = switched;
+    for (uint8_t k = 0; k < UDPCONTROL_SEQ_SPACES; ++k) {
+      const Ack ack = deliver(rebooted, k ? command(highs[k], 7, R_OPEN, 0x03) : command(highs[k], 1, R_OPEN), 0x0A00A8C0, k ? UDP_GROUP_PORT : UDP_CONTROL_PORT);
+      CHECK(ack.status != UDPCONTROL_OK && ack.high >= highs[k] && switched == after);
+      highs[k] = ack.high;
+    }
+  }
+
+  // A cut between moving the group lease to a fresh sector and writing the command lease: the
+  // superseded sector has the newest command lease then, it must not be lost with its erase.
+  unsigned long moves = 0;
+  for (unsigned int i = 0; i < 2 * FLASH_SECTOR_SIZE / sizeof(UdpControl::Lease); ++i) {
+    {
+      UdpControl board;
+      board.begin(RELAY_NUMBER_OF_CHANNELS);
+      // one flash operation, unless the sector is switched
+      hosttest::flashOpsUntilPowerCut = 1;
+      try {
+        deliver(board, command(highs[0] + 1, 1, R_OPEN));
+        highs[0] = highs[0] + 1;
+      } catch (const hosttest::PowerCut &) {
+        ++moves;
+      }
+      hosttest::flashOpsUntilPowerCut = -1;
+    }
+    for (int boot = 0; boot < 2; ++boot) {
+      UdpControl rebooted;
+      rebooted.begin(RELAY_NUMBER_OF_CHANNELS);
+      rebooted.service();
+      for (uint8_t k = 0; k < UDPCONTROL_SEQ_SPACES; ++k) {
+        const Ack ack = deliver(rebooted, k ? command(highs[k], 7, R_OPEN, 0x03) : command(highs[k], 1, R_OPEN), 0x0A00A8C0, k ? UDP_GROUP_PORT : UDP_CONTROL_PORT);
+        CHECK(ack.status != UDPCONTROL_OK && ack.high >= highs[k]);
+        highs[k] = ack.high;
+      }
+    }
+  }
+  CHECK(moves > 0);
+  CHECK(cuts > 0);
+  CHECK(hosttest::flashErases > 2);
+  printf("%lu lease writes, %lu sector erases, %lu power cuts\n", hosttest::flashWrites, hosttest::flashErases, cuts);
+
+  return hosttest::failures != 0;
+}
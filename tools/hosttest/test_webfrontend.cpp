@@ -0,0 +1,225 @@
+/**
+ * Web front end against clients that don't play along: when all slots are taken the longest
+ * idle kept-alive connection makes room, busy ones don't. A client not taking a write holds up
+ * service() for one WEBFRONTEND_WRITE_MS wait, the rest of its response is skipped and the
+ * connection closed. A handler taking over a kept-alive connection gets it unclosed.
+ */
+// units: WebFrontEnd.cpp Logger.cpp SerialTx.cpp
+
+#include "hosttest.h"
+#include "WebFrontEnd.h"
+#include "RemoteRelay.h"
+#include "SerialTx.h"
+#include <deque>
+#include <map>
+
+SerialTx serialTx;
+Logger logger;
+RemoteRelaySettings settings;
+
+/**
+ * The peer of each WiFiClient, by the id fd_ points to. room is what the client takes
+ * before a write falls short, each short write waits WEBFRONTEND_WRITE_MS like the real one.
+ */
+struct Peer {
+  std::string in;
+  std::string out;
+  size_t room = SIZE_MAX;
+  bool open = true;
+  unsigned int writes = 0;
+};
+static std::map<int, Peer> peers;
+static std::deque<int> backlog;
+
+static Peer *peer(const WiFiClient &c) {
+  return c.fd_ ? &peers[*c.fd_] : nullptr;
+}
+
+WiFiClient::WiFiClient() {}
+WiFiClient::WiFiClient(const WiFiClient &o) : fd_(o.fd_) {}
+WiFiClient &WiFiClient::operator=(const WiFiClient &o) { fd_ = o.fd_; return *this; }
+WiFiClient::~WiFiClient() {}
+uint8_t WiFiClient::connected() { return peer(*this) != nullptr && (peer(*this)->open || !peer(*this)->in.empty()); }
+void WiFiClient::stop() {
+  if (peer(*this) != nullptr) {
+    peer(*this)->open = false;
+  }
+}
+int WiFiClient::available() { return peer(*this) != nullptr ? peer(*this)->in.size() : 0; }
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+int WiFiClient::read(uint8_t * const buffer, const size_t len) {
+  Peer * const p = peer(*this);
+  const size_t n = p != nullptr ? min(len, p->in.size()) : 0;
+  if (n > 0) {
+    memcpy(buffer, p->in.data(), n);
+    p->in.erase(0, n);
+  }
+  return n;
+}
+int WiFiClient::peek() { return available() > 0 ? (uint8_t) peer(*this)->in[0] : -1; }
+size_t WiFiClient::write(const uint8_t c) { return write(&c, 1); }
+size_t WiFiClient::write(const uint8_t * const bytes, const size_t len) {
+  Peer * const p = peer(*this);
+  if (p == nullptr || !p->open) {
+return 0;
+  }
+  ++p->writes;
+  const size_t n = min(len, p->room);
+  p->out.append((const char *) bytes, n);
+  if (p->room != SIZE_MAX) {
+    p->room -= n;
+  }
+  if (n < len) {
+    hosttest::now += WEBFRONTEND_WRITE_MS;
+  }
+  return n;
+}
+size_t WiFiClient::write_P(const char * const bytes, const size_t len) { return write((const uint8_t *) bytes, len); }
+int WiFiClient::availableForWrite() { return 0; }
+void WiFiClient::setNoDelay(bool) {}
+
+WiFiServer::WiFiServer(uint16_t) {}
+void WiFiServer::begin() {}
+void WiFiServer::setNoDelay(bool) {}
+bool WiFiServer::hasClient() { return !backlog.empty(); }
+WiFiClient WiFiServer::accept() {
+  WiFiClient c;
+  if (!backlog.empty()) {
+    c.fd_ = std::make_shared<int>(backlog.front());
+    backlog.pop_front();
+  }
+  return c;
+}
+
+/**
+ * A client connecting, its id.
+ */
+static int connect(const char * const request = "") {
+  static int next = 0;
+  peers[next].in = request;
+  backlog.push_back(next);
+  return next++;
+}
+
+static std::map<int, WiFiClient> takenOver;
+
+/**
+ * GET /hello answers, GET /events/<id> takes the connection over like the event stream.
+ */
+static bool dispatch(WebRequest &request) {
+  if (strcmp(request.uri(), "/hello") == 0) {
+    request.send(200, "text/plain", "hello, world\r\n", 14);
+return true;
+  }
+  if (strncmp(request.uri(), "/events/", 8) == 0) {
+    takenOver[atoi(request.uri() + 8)] = request.client();
+return true;
+  }
+  return false;
+}
+
+static const char HELLO[] = "GET /hello HTTP/1.1\r\nHost: rr\r\n\r\n";
+
+int main() {
+  WebFrontEnd front(80);
+  front.begin(dispatch);
+
+  // all slots kept alive, a new client evicts the longest idle one
+  {
+    int idle[WEBFRONTEND_CONNECTIONS];
+    for (int &id : idle) {
+      id = connect(HELLO);
+      front.service();
+      CHECK(peers[id].out.find("HTTP/1.1 200 OK\r\n") == 0 && peers[id].open);
+      hosttest::now += 10;
+    }
+    const int late = connect(HELLO);
+    front.service();
+    CHECK(front.getEvicted() == 1 && !peers[idle[0]].open);
+    CHECK(peers[late].out.find("hello, world") != std::string::npos);
+    for (int i = 1; i < WEBFRONTEND_CONNECTIONS; ++i) {
+      CHECK(peers[idle[i]].open);
+    }
+
+    // a kept-alive connection serves the next request
+    peers[idle[1]].in = HELLO;
+    peers[idle[1]].out.clear();
+    front.service();
+    CHECK(peers[idle[1]].out.find("hello, world") != std::string::npos && front.getKeptAlive() == 1);
+
+    // all slots busy receiving, the next client waits in the backlog
+    for (int i = 1; i < WEBFRONTEND_CONNECTIONS; ++i) {
+      peers[idle[i]].in = "GET /hel";
+    }
+    peers[late].in = "GET /hel";
+    front.service();
+    const int waiting = connect(HELLO);
+    front.service();
+    CHECK(front.getEvicted() == 1 && backlog.size() == 1 && peers[waiting].out.empty());
+    for (int i = 1; i < WEBFRONTEND_CONNECTIONS; ++i) {
+      CHECK(peers[idle[i]].open);
+    }
+
+    // they time out, then it's served
+    hosttest::now += WEBFRONTEND_REQUEST_MS + 1;
+    front.service();
+    CHECK(!peers[late].open);
+    front.service();
+    CHECK(backlog.empty() && peers[waiting].out.find("hello, world") != std::string::npos);
+    hosttest::now += HTTP_KEEPALIVE_IDLE_MS + 1;
+    front.service();
+    CHECK(!peers[waiting].open);
+  }
+
+  // a short write waits once, the rest of the response is skipped and the connection closed
+  {
+    const int slow = connect(HELLO);
+    peers[slow].room = 20;
+    const unsigned long before = hosttest::now;
+    front.service();
+    CHECK(hosttest::now - before == WEBFRONTEND_WRITE_MS);
+    CHECK(peers[slow].out == "HTTP/1.1 200 OK\r\nCon");
+    CHECK(peers[slow].writes == 1 && !peers[slow].open);
+
+    // the next client isn't held up
+    const int fast = connect(HELLO);
+    const unsigned long later = hosttest::now;
+    front.service();
+    CHECK(hosttest::now == later && peers[fast].out.find("hello, world") != std::string::npos);
+    peers[fast].in = "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n";
+    front.service();
+    CHECK(!peers[fast].open);
+  }
+
+  // a handler takes over a kept-alive connection, the front end forgets it unclosed
+  {
+    const int id = connect(HELLO);
+    front.service();
+    const std::string events = "GET /events/" + std::to_string(id) + " HTTP/1.1\r\n\r\n";
+    peers[id].in = events;
+    peers[id].out.clear();
+    front.service();
+    CHECK(takenOver.count(id) == 1 && peers[id].open && peers[id].out.empty());
+    // its slot is free again: all of them serve without evicting
+    const unsigned int evicted = front.getEvicted();
+    int others[WEBFRONTEND_CONNECTIONS];
+    for (int &o : others) {
+      o = connect(HELLO);
+      front.service();
+    }
+    CHECK(front.getEvicted() == evicted);
+    hosttest::now += HTTP_KEEPALIVE_IDLE_MS + 1;
+    front.service();
+    for (const int o : others) {
+      CHECK(!peers[o].open);
+    }
+    CHECK(peers[id].open);
+    takenOver[id].stop();
+    CHECK(!peers[id].open);
+  }
+
+  return hosttest::failures > 0;
+}
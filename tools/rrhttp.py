@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Benchmark of the RemoteRelay web API with and without HTTP/1.1 keep-alive.
+
+  rrhttp.py HOST[:PORT] [N] [PATH]    N requests (default 200) of GET PATH (default /channel/1) each:
+                               a new connection per request, one kept-alive connection,
+                               and one connection with 4 requests pipelined at a time
+
+Credentials are taken from RR_LOGIN and RR_PASSWORD, the same as for tools/rrudp.py.
+"""
+
+import base64
+import http.client
+import os
+import socket
+import sys
+import time
+
+PORT = 80
+PIPELINE_DEPTH = 4
+
+
+def request_headers(login, password):
+    headers = {}
+    if login or password:
+        headers["Authorization"] = "Basic " + base64.b64encode(("%s:%s" % (login, password)).encode()).decode()
+    return headers
+
+
+def run(name, count, fn):
+    start = time.perf_counter()
+    fn(count)
+    seconds = time.perf_counter() - start
+    print("%-11s %7.1f requests/s" % (name + ":", count / seconds))
+
+
+def with_close(host, port, path, headers):
+    def fn(count):
+        for _ in range(count):
+            conn = http.client.HTTPConnection(host, port, timeout=5)
+            conn.request("GET", path, headers=dict(headers, Connection="close"))
+            conn.getresponse().read()
+            conn.close()
+    return fn
+
+
+def with_keepalive(host, port, path, headers):
+    def fn(count):
+        conn = http.client.HTTPConnection(host, port, timeout=5)
+        for _ in range(count):
+            conn.request("GET", path, headers=headers)
+            response = conn.getresponse()
+            response.read()
+            if response.getheader("Connection", "").lower() == "close":
+                # request limit reached
+                conn.close()
+        conn.close()
+    return fn
+
+
+def read_response(stream):
+    """
+    Reads one response with Content-Length from a file object, returns the status code.
+    """
+    status = int(stream.readline().split()[1])
+    length = 0
+    close = False
+    while True:
+        line = stream.readline().strip()
+        if not line:
+            break
+        name, _, value = line.decode().partition(":")
+        if name.lower() == "content-length":
+            length = int(value)
+        elif name.lower() == "connection":
+            close = value.strip().lower() == "close"
+    stream.read(length)
+    return status, close
+
+
+def with_pipelining(host, port, path, headers):
+    raw = "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n" % (
+        path, host, "".join("%s: %s\r\n" % h for h in headers.items()))
+
+    def fn(count):
+        sock = None
+        sent = 0
+        while sent < count:
+            if sock is None:
+                sock = socket.create_connection((host, port), timeout=5)
+                stream = sock.makefile("rb")
+            batch = min(PIPELINE_DEPTH, count - sent)
+            sock.sendall(raw.encode() * batch)
+            for _ in range(batch):
+                status, close = read_response(stream)
+                if status != 200:
+                    raise RuntimeError("HTTP %d" % status)
+                sent += 1
+                if close:
+                    # the rest of the batch is lost with the connection, send it again
+                    stream.close()
+                    sock.close()
+                    sock = None
+                    break
+        if sock is not None:
+            stream.close()
+            sock.close()
+    return fn
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.exit(__doc__)
+    host, _, port = argv[1].partition(":")
+    port = int(port or PORT)
+    count = int(argv[2]) if len(argv) > 2 else 200
+    path = argv[3] if len(argv) > 3 else "/channel/1"
+    headers = request_headers(os.environ.get("RR_LOGIN", ""), os.environ.get("RR_PASSWORD", ""))
+    run("close", count, with_close(host, port, path, headers))
+    run("keep-alive", count, with_keepalive(host, port, path, headers))
+    run("pipelined", count, with_pipelining(host, port, path, headers))
+
+
+if __name__ == "__main__":
+    main(sys.argv)
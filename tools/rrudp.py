@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""
+Client for the RemoteRelay UDP control port (see UdpControl.h).
+
+  rrudp.py HOST on 1 off 2     switch channel 1 on and 2 off in one datagram
+  rrudp.py HOST state          print the channel states
+  rrudp.py HOST bench [N]      compare the round trip with PUT /channel/1
+  rrudp.py GROUPADDR group G on|off [BOARDS]
+                               switch group G on all boards that mapped it (see POST /groups),
+                               retried until BOARDS boards acked, lists them with their ack times
+
+Credentials are taken from RR_LOGIN and RR_PASSWORD, the same as for the web API.
+"""
+
+import hashlib
+import hmac
+import os
+import socket
+import struct
+import sys
+import time
+
+PORT = 8081
+GROUP_PORT = 8082
+TAG_LEN = 16
+MODE_OFF, MODE_ON, MODE_QUERY = 0, 1, 2
+STATUS = {0: "ok", 1: "invalid", 2: "stale"}
+ACK_LEN = 14
+
+
+class RemoteRelayUdp:
+    def __init__(self, host, login="", password="", port=PORT, timeout=0.2, retries=5):
+        self.addr = (host, port)
+        self.key = ("%s:%s" % (login, password)).encode()
+        self.timeout = timeout
+        self.retries = retries
+        # must increase across client restarts too, the device remembers the newest one it took
+        # from anyone (even across its reboots), one for commands and one for group commands.
+        # 0.1 s since 2024 lasts until 2037, a stale ack tells where to continue anyway.
+        self.seq = int((time.time() - 1704067200) * 10) & 0xFFFFFFFF
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(timeout)
+
+    def _tag(self, data):
+        return hmac.new(self.key, data, hashlib.sha256).digest()[:TAG_LEN]
+
+    def _packet(self, kind, ops):
+        self.seq = (self.seq + 1) & 0xFFFFFFFF
+        body = struct.pack(">2sBBI", b"RU", kind, len(ops), self.seq)
+        body += b"".join(struct.pack("BB", c, m) for c, m in ops)
+        return body + self._tag(body)
+
+    def send(self, ops):
+        """
+        ops is a list of (channel, mode). Retries with the same seq until acked.
+        Returns (status, states) where states is a list of booleans, channel 1 first.
+        """
+        packet = self._packet(0x01, ops)
+        resynced = False
+        for _ in range(self.retries):
+            self.sock.sendto(packet, self.addr)
+            try:
+                while True:
+                    ack = self._ack(self.sock.recv(64))
+                    if ack is None or ack[1] != self.seq:
+                        continue
+                    status, seq, states, high = ack
+                    if status == "stale" and not resynced:
+                        # another client, or our clock is behind: once more after the device's newest
+                        self.seq = high
+                        packet = self._packet(0x01, ops)
+                        resynced = True
+                        break
+                    return status, states
+            except socket.timeout:
+                pass
+        raise TimeoutError("no ack from %s:%d" % self.addr)
+
+    def _ack(self, ack):
+        """
+        Returns (status, seq, states, high) of a valid ack, None otherwise.
+        """
+        if len(ack) != ACK_LEN + TAG_LEN or not hmac.compare_digest(ack[ACK_LEN:], self._tag(ack[:ACK_LEN])):
+            return None
+        magic, kind, status, seq, states, count, high = struct.unpack(">2sBBIBBI", ack[:ACK_LEN])
+        if magic != b"RU" or kind != 0x81:
+            return None
+        return STATUS.get(status, status), seq, [bool(states >> i & 1) for i in range(count)], high
+
+    def group(self, address, ops, boards=0, ttl=1):
+        """
+        Sends a group command to a multicast address, ops is a list of (group, mode).
+        With boards > 0 acks are requested and the datagram is repeated (same seq) until that
+        many boards acked. Boards that found it stale get it again after the newest seq of all
+        of them. Returns {board address: (seconds until its ack, status, states)}.
+        """
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, ttl)
+        packet = self._packet(0x03 if boards else 0x02, ops)
+        acks = {}
+        start = time.perf_counter()
+        for _ in range(self.retries if boards else 1):
+            self.sock.sendto(packet, (address, GROUP_PORT))
+            high = None
+            try:
+                while boards and len(acks) < boards:
+                    data, sender = self.sock.recvfrom(64)
+                    ack = self._ack(data)
+                    if ack is None or ack[1] != self.seq or sender[0] in acks:
+                        continue
+                    if ack[0] == "stale":
+                        high = max(high or 0, ack[3])
+                        continue
+                    acks[sender[0]] = (time.perf_counter() - start, ack[0], ack[2])
+            except socket.timeout:
+                pass
+            if len(acks) >= boards:
+                break
+            if high is not None:
+                # a no-op for boards that switched already
+                self.seq = max(self.seq, high)
+                packet = self._packet(0x03, ops)
+        return acks
+
+    def switch(self, channel, on):
+        return self.send([(channel, MODE_ON if on else MODE_OFF)])
+
+    def states(self):
+        return self.send([(0, MODE_QUERY)])[1]
+
+
+def bench(client, host, count):
+    import base64
+    import http.client
+
+    def percentiles(samples):
+        samples.sort()
+        return "median %.1f ms, p95 %.1f ms" % (samples[len(samples) // 2] * 1000, samples[int(len(samples) * 0.95)] * 1000)
+
+    udp = []
+    for i in range(count):
+        start = time.perf_counter()
+        client.switch(1, i & 1)
+        udp.append(time.perf_counter() - start)
+        time.sleep(0.3)  # stay above the minimum switching interval
+    print("UDP : " + percentiles(udp))
+
+    headers = {}
+    if client.key != b":":
+        headers["Authorization"] = "Basic " + base64.b64encode(client.key).decode()
+    http_times = []
+    for i in range(count):
+        start = time.perf_counter()
+        # a new connection each time, like curl
+        conn = http.client.HTTPConnection(host, 80, timeout=5)
+        conn.request("PUT", "/channel/1", "mode=" + ("on" if i & 1 else "off"),
+                     dict(headers, **{"Content-Type": "application/x-www-form-urlencoded"}))
+        conn.getresponse().read()
+        conn.close()
+        http_times.append(time.perf_counter() - start)
+        time.sleep(0.3)
+    print("HTTP: " + percentiles(http_times))
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.exit(__doc__)
+    client = RemoteRelayUdp(argv[1], os.environ.get("RR_LOGIN", ""), os.environ.get("RR_PASSWORD", ""))
+    if argv[2] == "state":
+        print(" ".join("%d=%s" % (i + 1, "on" if s else "off") for i, s in enumerate(client.states())))
+    elif argv[2] == "group":
+        boards = int(argv[5]) if len(argv) > 5 else 0
+        acks = client.group(argv[1], [(int(argv[3]), MODE_ON if argv[4] == "on" else MODE_OFF)], boards)
+        for board, (seconds, status, states) in sorted(acks.items(), key=lambda a: a[1][0]):
+            print("%-15s %6.1f ms %s %s" % (board, seconds * 1000, status,
+                                           " ".join("%d=%s" % (i + 1, "on" if s else "off") for i, s in enumerate(states))))
+        if len(acks) < boards:
+            print("%d of %d boards didn't ack" % (boards - len(acks), boards))
+            sys.exit(1)
+    elif argv[2] == "bench":
+        bench(client, argv[1], int(argv[3]) if len(argv) > 3 else 50)
+    else:
+        words = argv[2:]
+        ops = [(int(c), MODE_ON if m == "on" else MODE_OFF) for m, c in zip(words[::2], words[1::2])]
+        status, states = client.send(ops)
+        print(status, " ".join("%d=%s" % (i + 1, "on" if s else "off") for i, s in enumerate(states)))
+
+
+if __name__ == "__main__":
+    main(sys.argv)